@@ -0,0 +1,106 @@
+#include <algorithm>
+#include <cmath>
+
+#include "animation.hh"
+
+
+animator::animator(std::chrono::milliseconds tick_time_)
+: tick(std::max(tick_time_, std::chrono::milliseconds(1)))
+{
+}
+
+
+unsigned animator::ticks(std::chrono::milliseconds d) const
+{
+  return std::max(1l, std::lround(double(d.count()) / tick.count()));
+}
+
+
+animator::id_type animator::add(std::vector<frame>&& frames, show_type show)
+{
+  std::lock_guard<std::mutex> guard(m);
+  auto id = next_id++;
+  auto due = now + frames[0].ticks;
+  auto single = frames.size() == 1;
+  animations.emplace(id, animation{ std::move(frames), 0, due, std::move(show) });
+  if (! single) {
+    wheel[due % wheel_size].push_back(id);
+    if (timer == 0)
+      timer = timers.start(tick, [this]{ advance(); });
+  }
+  return id;
+}
+
+
+void animator::remove(id_type id)
+{
+  // The identifier stays in the wheel until its slot is processed next.
+  std::lock_guard<std::mutex> show_guard(show_m);
+  std::lock_guard<std::mutex> guard(m);
+  animations.erase(id);
+  if (animations.empty() && timer != 0) {
+    timers.stop(timer);
+    timer = 0;
+  }
+}
+
+
+int animator::current(id_type id)
+{
+  std::lock_guard<std::mutex> guard(m);
+  auto& a = animations.at(id);
+  return a.frames[a.cur].handle;
+}
+
+
+void animator::advance()
+{
+  // Animations whose frame changes and the handle of the new frame.
+  thread_local std::vector<std::pair<id_type,int>> changed;
+  changed.clear();
+
+  {
+    std::lock_guard<std::mutex> guard(m);
+    auto& slot = wheel[++now % wheel_size];
+    if (slot.empty())
+      return;
+
+    // The slot can receive new entries while it is processed.
+    thread_local std::vector<id_type> ids;
+    ids.clear();
+    std::swap(ids, slot);
+
+    for (auto id : ids) {
+      auto it = animations.find(id);
+      if (it == animations.end())
+        continue;
+      auto& a = it->second;
+      if (a.due != now) {
+        // Due in a later round of the wheel.
+        slot.push_back(id);
+        continue;
+      }
+
+      if (++a.cur == a.frames.size())
+        a.cur = 0;
+      a.due = now + a.frames[a.cur].ticks;
+      wheel[a.due % wheel_size].push_back(id);
+
+      changed.emplace_back(id, a.frames[a.cur].handle);
+    }
+  }
+
+  // Animations removed in the meantime are skipped.  Holding SHOW_M keeps the animation
+  // alive while SHOW runs, adding animations does not move it.
+  for (auto [id, handle] : changed) {
+    std::lock_guard<std::mutex> show_guard(show_m);
+    const show_type* show = nullptr;
+    {
+      std::lock_guard<std::mutex> guard(m);
+      if (auto it = animations.find(id); it != animations.end())
+        show = &it->second.show;
+    }
+    if (show != nullptr)
+      (*show)(handle);
+  }
+}
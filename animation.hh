@@ -0,0 +1,73 @@
+#ifndef _ANIMATION_HH
+#define _ANIMATION_HH 1
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "timer.hh"
+
+
+// Animations of keys as sequences of registered device images.  The frames are decoded,
+// composited, and registered before the animation is added.  A single timer with a fixed
+// tick drives all animations; on a tick only the handles of the keys whose frame changes
+// are sent to the device.  The animations waiting for a frame change are kept in a timer
+// wheel indexed by the tick of the change.
+struct animator {
+  using id_type = unsigned;
+  using show_type = std::function<void(int)>;
+
+  struct frame {
+    int handle;
+    // Number of ticks the frame is shown, at least one.
+    unsigned ticks;
+  };
+
+  animator(std::chrono::milliseconds tick_time_);
+
+  std::chrono::milliseconds tick_time() const { return tick; }
+  // Number of ticks to show a frame for the duration D, at least one.
+  unsigned ticks(std::chrono::milliseconds d) const;
+
+  // Start the animation.  SHOW is called with the handle of the new frame whenever the frame
+  // changes, by the timer thread.  It is never called after REMOVE returns.
+  id_type add(std::vector<frame>&& frames, show_type show);
+  void remove(id_type id);
+
+  // Handle of the frame which currently has to be shown.
+  int current(id_type id);
+
+private:
+  void advance();
+
+  static constexpr size_t wheel_size = 64;
+
+  struct animation {
+    std::vector<frame> frames;
+    size_t cur;
+    uint64_t due;
+    show_type show;
+  };
+
+  const std::chrono::milliseconds tick;
+
+  // The device is updated outside of M.  SHOW_M is held while SHOW of an animation is
+  // called and when an animation is removed; it is always taken before M.
+  std::mutex show_m;
+  std::mutex m;
+  uint64_t now = 0;
+  id_type next_id = 1;
+  std::unordered_map<id_type,animation> animations;
+  std::array<std::vector<id_type>,wheel_size> wheel;
+
+  // The timer only runs while there are animations.  The service is the last member, the
+  // thread is stopped before anything else is destroyed.
+  timer_service::id_type timer = 0;
+  timer_service timers;
+};
+
+#endif // animation.hh
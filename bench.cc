@@ -0,0 +1,680 @@
+// Benchmarks for the rendering code and the handling of OBS events.  The numbers are meant
+// to compare implementations on the same machine, they are not stable across machines.
+// The check "items" verifies the handling of stale scene item events; the exit status
+// is not zero if it fails.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <Magick++.h>
+#include <json/json.h>
+
+#include "buttontext.hh"
+#include "composite.hh"
+#include "events.hh"
+#include "ftlibrary.hh"
+#include "sceneitems.hh"
+
+
+using Magick::Quantum;
+
+
+namespace {
+
+  // Number of calls of operator new.
+  std::atomic<size_t> heap_allocations;
+
+
+  // Key sizes of the different Stream Deck models.
+  const unsigned key_sizes[] = { 72, 96, 120 };
+
+
+  // Run F repeatedly for at least a quarter of a second and return the average time of one
+  // call in microseconds.
+  double measure(const std::function<void()>& f)
+  {
+    using clock = std::chrono::steady_clock;
+    f();
+    unsigned n = 0;
+    auto start = clock::now();
+    auto now = start;
+    do {
+      for (unsigned i = 0; i < 16; ++i)
+        f();
+      n += 16;
+      now = clock::now();
+    } while (now - start < std::chrono::milliseconds(250));
+    return std::chrono::duration<double,std::micro>(now - start).count() / n;
+  }
+
+
+  // Text coverage similar to what FreeType produces: about a third of the pixels are fully
+  // covered, a third are empty, the rest are anti-aliased edges.
+  std::vector<uint8_t> make_coverage(unsigned width, unsigned height)
+  {
+    std::vector<uint8_t> res(width * height);
+    for (unsigned y = 0; y < height; ++y)
+      for (unsigned x = 0; x < width; ++x) {
+        auto v = (x * 37 + y * 11 + x * y) % 96;
+        res[y * width + x] = v < 32 ? 0 : v < 64 ? 255 : (v - 64) * 8;
+      }
+    return res;
+  }
+
+
+  // The per-pixel loop render_to_image::finish used before composite_row.
+  void legacy_composite(Magick::Image& image, const std::vector<uint8_t>& coverage, unsigned offx, unsigned offy, unsigned width, unsigned height, const Magick::Color& foreground)
+  {
+    image.modifyImage();
+    auto imwidth = image.columns();
+    auto mem = image.getPixels(0, 0, imwidth, image.rows());
+    auto foreground_red = foreground.quantumRed();
+    auto foreground_green = foreground.quantumGreen();
+    auto foreground_blue = foreground.quantumBlue();
+
+    for (unsigned y = 0; y < height; ++y)
+      for (unsigned x = 0; x < width; ++x) {
+        auto c = coverage[y * width + x];
+        auto foreground_alpha = QuantumRange * c / 255;
+        auto memoffset = ((offy + y) * imwidth + offx + x) * 4;
+        Quantum red = mem[memoffset];
+        Quantum green = mem[memoffset + 1];
+        Quantum blue = mem[memoffset + 2];
+        Quantum opacity = mem[memoffset + 3];
+        if (opacity != 0 && foreground_alpha != 0) {
+          auto alphamem = opacity / double(QuantumRange);
+          opacity = foreground_alpha * opacity / double(QuantumRange);
+          auto alphares = 1.0 - opacity / double(QuantumRange);
+          auto alphatext = c / 255.0;
+          red = 1.0 / alphares * (alphatext * foreground_red + (1.0 - alphatext) * alphamem * red);
+          green = 1.0 / alphares * (alphatext * foreground_green + (1.0 - alphatext) * alphamem * green);
+          blue = 1.0 / alphares * (alphatext * foreground_blue + (1.0 - alphatext) * alphamem * blue);
+        } else if (opacity == 0) {
+          red = foreground_red;
+          green = foreground_green;
+          blue = foreground_blue;
+          opacity = foreground_alpha;
+        }
+        mem[memoffset] = red;
+        mem[memoffset + 1] = green;
+        mem[memoffset + 2] = blue;
+        mem[memoffset + 3] = opacity;
+      }
+
+    image.syncPixels();
+  }
+
+
+  void bench_composite()
+  {
+    std::cout << "text compositing (microseconds per key image)\n"
+              << std::setw(8) << "size" << std::setw(10) << "legacy" << std::setw(10) << "finish"
+              << std::setw(10) << "scalar";
+#if defined __x86_64__ || defined __i386__
+    std::cout << std::setw(10) << "sse2";
+    if (__builtin_cpu_supports("avx2"))
+      std::cout << std::setw(10) << "avx2";
+#endif
+    std::cout << '\n';
+
+    const Magick::Color foreground("white");
+    const composite_color fg{ 255, 255, 255 };
+
+    for (auto size : key_sizes) {
+      // The text covers 80% of the key in both directions.
+      unsigned width = size * 8 / 10;
+      unsigned height = size * 8 / 10;
+      unsigned offx = (size - width) / 2;
+      unsigned offy = (size - height) / 2;
+      auto coverage = make_coverage(width, height);
+      Magick::Image background(Magick::Geometry(size, size), Magick::Color("darkgray"));
+
+      std::cout << std::setw(4) << size << 'x' << std::setw(3) << size;
+
+      std::cout << std::setw(10) << measure([&]{
+        Magick::Image image(background);
+        legacy_composite(image, coverage, offx, offy, width, height, foreground);
+      });
+
+      // Like render_to_image::finish: export, blend, import.
+      std::vector<uint8_t> mem(size * size * 4);
+      std::cout << std::setw(10) << measure([&]{
+        background.write(0, 0, size, size, "RGBA", Magick::CharPixel, mem.data());
+        for (unsigned y = 0; y < height; ++y)
+          composite_row(&mem[((offy + y) * size + offx) * 4], &coverage[y * width], width, fg);
+        Magick::Image image(size, size, "RGBA", Magick::CharPixel, mem.data());
+      });
+
+      // The kernels alone.
+      background.write(0, 0, size, size, "RGBA", Magick::CharPixel, mem.data());
+      auto kernel = [&](composite_row_fn fct) {
+        auto work = mem;
+        return measure([&]{
+          for (unsigned y = 0; y < height; ++y)
+            fct(&work[((offy + y) * size + offx) * 4], &coverage[y * width], width, fg);
+        });
+      };
+      std::cout << std::setw(10) << kernel(composite_row_scalar);
+#if defined __x86_64__ || defined __i386__
+      std::cout << std::setw(10) << kernel(composite_row_sse2);
+      if (__builtin_cpu_supports("avx2"))
+        std::cout << std::setw(10) << kernel(composite_row_avx2);
+#endif
+      std::cout << '\n';
+    }
+  }
+
+
+  // Text of the auto button, rendered over and over again by the same object.  After the
+  // first renders no memory should be allocated.
+  void bench_label(ftlibrary& ftobj)
+  {
+    std::cout << "\nauto button text (microseconds per render, allocations per render)\n"
+              << std::setw(8) << "size" << std::setw(10) << "time" << std::setw(10) << "heap" << std::setw(10) << "growth" << '\n';
+
+    ftface face(ftobj, "Sans");
+    const Magick::Color foreground("white");
+    const std::string text("1.5");
+
+    for (auto size : key_sizes) {
+      rgba_buffer background(Magick::Image(Magick::Geometry(size, size), Magick::Color("darkgray")));
+      rgba_buffer buffer;
+      render_to_rgba_buffer renderer(background, buffer, 0.8, 0.3);
+      auto draw = [&]{
+        font_render<render_to_rgba_buffer&> renderobj(face, renderer);
+        renderobj.draw(text, foreground, 0.5, 0.5);
+      };
+
+      auto us = measure(draw);
+
+      const unsigned n = 100;
+      auto heap = heap_allocations.load();
+      auto growth = renderer.allocations();
+      for (unsigned i = 0; i < n; ++i)
+        draw();
+
+      std::cout << std::setw(4) << size << 'x' << std::setw(3) << size << std::setw(10) << us
+                << std::setw(10) << double(heap_allocations - heap) / n
+                << std::setw(10) << double(renderer.allocations() - growth) / n << '\n';
+    }
+  }
+
+
+
+  // Time spent in the phases of font_render::draw.  The glyph phase is the time between
+  // the calls to the renderer while a line is laid out, i.e., the lookup or rasterization
+  // of the glyphs and the kerning.  Everything else the renderer does before finish is
+  // attributed to fitting the text.
+  struct phase_times {
+    using clock = std::chrono::steady_clock;
+
+    double glyphs = 0;
+    double fit = 0;
+    double finish = 0;
+    size_t draws = 0;
+    size_t renders = 0;
+    size_t iterations = 0;
+
+    clock::time_point last;
+
+    static double elapsed(clock::time_point since) { return std::chrono::duration<double,std::micro>(clock::now() - since).count(); }
+  };
+
+
+  // Renderer as used for the scene and source labels which records the phase times.
+  // font_render only uses the static type of the renderer, hiding the functions of the
+  // base class is sufficient.
+  struct timed_render : render_to_image {
+    timed_render(phase_times& times_, const Magick::Image& background_, double widthfactor, double heightfactor)
+    : render_to_image(background_, widthfactor, heightfactor), times(times_)
+    {
+    }
+
+    void start()
+    {
+      auto t0 = phase_times::clock::now();
+      render_to_image::start();
+      times.last = phase_times::clock::now();
+      times.fit += std::chrono::duration<double,std::micro>(times.last - t0).count();
+    }
+
+    void operator()(const ftglyph& glyph, FT_Int x)
+    {
+      auto t0 = phase_times::clock::now();
+      times.glyphs += std::chrono::duration<double,std::micro>(t0 - times.last).count();
+      render_to_image::operator()(glyph, x);
+      times.last = phase_times::clock::now();
+      times.fit += std::chrono::duration<double,std::micro>(times.last - t0).count();
+      ++times.renders;
+    }
+
+    void compute_dimensions()
+    {
+      auto t0 = phase_times::clock::now();
+      times.glyphs += std::chrono::duration<double,std::micro>(t0 - times.last).count();
+      render_to_image::compute_dimensions();
+      times.fit += phase_times::elapsed(t0);
+    }
+
+    std::pair<double,FT_UInt> first_font_size()
+    {
+      auto t0 = phase_times::clock::now();
+      auto res = render_to_image::first_font_size();
+      times.fit += phase_times::elapsed(t0);
+      return res;
+    }
+
+    double fit_font_size(unsigned measure_scale)
+    {
+      auto t0 = phase_times::clock::now();
+      auto res = render_to_image::fit_font_size(measure_scale);
+      times.fit += phase_times::elapsed(t0);
+      return res;
+    }
+
+    std::pair<bool,double> check_size()
+    {
+      auto t0 = phase_times::clock::now();
+      auto res = render_to_image::check_size();
+      times.fit += phase_times::elapsed(t0);
+      ++times.iterations;
+      return res;
+    }
+
+    Magick::Image finish(const Magick::Color& foreground, double posx, double posy)
+    {
+      auto t0 = phase_times::clock::now();
+      auto res = render_to_image::finish(foreground, posx, posy);
+      times.finish += phase_times::elapsed(t0);
+      ++times.draws;
+      return res;
+    }
+
+  private:
+    phase_times& times;
+  };
+
+
+  // Labels of different lengths and word counts.  Every word is placed on its own line,
+  // as for the scene and source buttons.
+  const std::vector<std::vector<std::string>> phase_labels = {
+    { "AV" },
+    { "Presentation" },
+    { "Main", "Camera" },
+    { "Screen", "Share", "Slides", "Deck" },
+    { "Über", "Größe" },
+  };
+  const char* const phase_fonts[] = { "Sans", "Serif", "Monospace" };
+
+
+  // Break down the time to draw a label into its phases.  The times are averages over
+  // many draws with a warm glyph cache, i.e., the steady state of the daemon.  The last
+  // columns do not depend on the machine and can be compared between versions directly:
+  // glyphs laid out, size checks (each rasterizes the text), and heap allocations per draw.
+  void bench_phases(ftlibrary& ftobj)
+  {
+    std::cout << "\nlabel phases (microseconds per draw)\n"
+              << std::setw(10) << "font" << std::setw(28) << "text" << std::setw(8) << "size"
+              << std::setw(9) << "total" << std::setw(9) << "utf8" << std::setw(9) << "glyphs"
+              << std::setw(9) << "fit" << std::setw(9) << "finish"
+              << std::setw(8) << "layout" << std::setw(6) << "iter" << std::setw(7) << "heap" << '\n';
+
+    const Magick::Color foreground("white");
+
+    // The decoding does not depend on the font and the key size.
+    std::vector<double> utf8;
+    for (const auto& label : phase_labels) {
+      std::vector<utf8proc_int32_t> wbuf;
+      utf8.push_back(measure([&]{
+        for (const auto& s : label)
+          convert_string(s, wbuf);
+      }));
+    }
+
+    for (auto fontname : phase_fonts) {
+      ftface face(ftobj, fontname);
+
+      for (size_t l = 0; l < phase_labels.size(); ++l) {
+        const auto& label = phase_labels[l];
+        // The column is padded by hand, the stream counts bytes, not characters.
+        std::string text;
+        for (const auto& s : label)
+          text += (text.empty() ? "" : " ") + s;
+        auto nchars = std::count_if(text.begin(), text.end(), [](char c){ return (c & 0xc0) != 0x80; });
+        text.insert(0, std::max<std::ptrdiff_t>(0, 28 - nchars), ' ');
+
+        for (auto size : key_sizes) {
+          Magick::Image background(Magick::Geometry(size, size), Magick::Color("darkgray"));
+          phase_times times;
+          auto draw = [&]{
+            font_render<timed_render> renderobj(face, times, background, 0.8, 0.8);
+            renderobj.draw(label, foreground, 0.5, 0.5);
+          };
+
+          auto us = measure(draw);
+          auto n = double(times.draws);
+          auto measured = times;
+
+          // The counts are taken separately, the timing data structures must not skew them.
+          const unsigned ncount = 20;
+          times = phase_times();
+          auto heap = heap_allocations.load();
+          for (unsigned i = 0; i < ncount; ++i)
+            draw();
+          heap = heap_allocations - heap;
+
+          std::cout << std::setw(10) << fontname << text << std::setw(4) << size << 'x' << std::setw(3) << size
+                    << std::setw(9) << us << std::setw(9) << utf8[l]
+                    << std::setw(9) << measured.glyphs / n << std::setw(9) << measured.fit / n << std::setw(9) << measured.finish / n
+                    << std::setw(8) << times.renders / ncount << std::setw(6) << times.iterations / ncount << std::setw(7) << heap / ncount << '\n';
+        }
+      }
+    }
+  }
+
+
+  // Events as recorded from OBS while switching scenes, toggling and reordering sources,
+  // dragging the transition duration slider, and recording.
+  const char recorded_events[] = R"([
+    {"eventType":"CurrentPreviewSceneChanged","eventData":{"sceneName":"Camera"}},
+    {"eventType":"SceneTransitionStarted","eventData":{"transitionName":"Fade"}},
+    {"eventType":"CurrentProgramSceneChanged","eventData":{"sceneName":"Camera"}},
+    {"eventType":"CurrentPreviewSceneChanged","eventData":{"sceneName":"Screen Share"}},
+    {"eventType":"SceneTransitionVideoEnded","eventData":{"transitionName":"Fade"}},
+    {"eventType":"SceneTransitionEnded","eventData":{"transitionName":"Fade"}},
+    {"eventType":"SceneItemEnableStateChanged","eventData":{"sceneName":"Camera","sceneItemId":3,"sceneItemEnabled":false}},
+    {"eventType":"SceneItemEnableStateChanged","eventData":{"sceneName":"Camera","sceneItemId":3,"sceneItemEnabled":true}},
+    {"eventType":"SceneItemSelected","eventData":{"sceneName":"Camera","sceneItemId":5}},
+    {"eventType":"SceneItemTransformChanged","eventData":{"sceneName":"Camera","sceneItemId":5,"sceneItemTransform":{"positionX":12.0,"positionY":40.0,"rotation":0.0,"scaleX":1.0,"scaleY":1.0}}},
+    {"eventType":"SceneItemListReindexed","eventData":{"sceneName":"Camera","sceneItems":[{"sceneItemId":1,"sceneItemIndex":0},{"sceneItemId":5,"sceneItemIndex":1},{"sceneItemId":3,"sceneItemIndex":2},{"sceneItemId":7,"sceneItemIndex":3},{"sceneItemId":8,"sceneItemIndex":4},{"sceneItemId":9,"sceneItemIndex":5}]}},
+    {"eventType":"CurrentSceneTransitionDurationChanged","eventData":{"transitionDuration":350}},
+    {"eventType":"CurrentSceneTransitionDurationChanged","eventData":{"transitionDuration":400}},
+    {"eventType":"CurrentSceneTransitionDurationChanged","eventData":{"transitionDuration":450}},
+    {"eventType":"CurrentSceneTransitionDurationChanged","eventData":{"transitionDuration":500}},
+    {"eventType":"InputSettingsChanged","eventData":{"inputName":"Microphone","inputUuid":"0d9f5b38-4f4a-4a52-9c35-2a8a0c1f6e11","inputSettings":{"device_id":"default"}}},
+    {"eventType":"InputNameChanged","eventData":{"inputUuid":"0d9f5b38-4f4a-4a52-9c35-2a8a0c1f6e11","oldInputName":"Microphone","inputName":"Headset Microphone"}},
+    {"eventType":"SceneItemCreated","eventData":{"sceneName":"Screen Share","sceneItemId":11,"sceneItemIndex":4,"sourceName":"Lower Third Banner","sourceUuid":"7b1c9e02-6d4f-4c0e-8f55-3d2c4a9b7e20"}},
+    {"eventType":"SceneItemRemoved","eventData":{"sceneName":"Screen Share","sceneItemId":11,"sourceName":"Lower Third Banner","sourceUuid":"7b1c9e02-6d4f-4c0e-8f55-3d2c4a9b7e20"}},
+    {"eventType":"SceneListChanged","eventData":{"scenes":[{"sceneIndex":0,"sceneName":"Black"},{"sceneIndex":1,"sceneName":"Starting Soon"},{"sceneIndex":2,"sceneName":"Camera"},{"sceneIndex":3,"sceneName":"Screen Share"},{"sceneIndex":4,"sceneName":"Interview Two Shot"},{"sceneIndex":5,"sceneName":"Be Right Back"},{"sceneIndex":6,"sceneName":"Ending"}]}},
+    {"eventType":"StudioModeStateChanged","eventData":{"studioModeEnabled":true}},
+    {"eventType":"RecordStateChanged","eventData":{"outputActive":true,"outputState":"OBS_WEBSOCKET_OUTPUT_STARTED","outputPath":"/home/user/Videos/2024-03-01 19-30-12.mkv"}},
+    {"eventType":"StreamStateChanged","eventData":{"outputActive":true,"outputState":"OBS_WEBSOCKET_OUTPUT_STARTED"}},
+    {"eventType":"VirtualcamStateChanged","eventData":{"outputActive":false,"outputState":"OBS_WEBSOCKET_OUTPUT_STOPPED"}}
+  ])";
+
+
+  // The requests as they were queued before they had typed payloads: all data converted
+  // to strings, comparisons of the event type with temporary JSON values.
+  struct legacy_request {
+    obs::work_request::work_type type;
+    unsigned nr = 0;
+    std::vector<std::string> names;
+  };
+
+  legacy_request legacy_parse(const Json::Value& val)
+  {
+    using work_type = obs::work_request::work_type;
+    std::vector<std::string> vs;
+    unsigned nr = 0;
+    work_type type(work_type::none);
+
+    auto event_type = val["eventType"];
+    if (event_type == "CurrentProgramSceneChanged") {
+      vs.emplace_back(val["eventData"]["sceneName"].asString());
+      type = work_type::scene;
+    } else if (event_type == "CurrentPreviewSceneChanged") {
+      vs.emplace_back(val["eventData"]["sceneName"].asString());
+      type = work_type::preview;
+    } else if (event_type == "CurrentSceneTransitionChanged") {
+      vs.emplace_back(val["eventData"]["transitionName"].asString());
+      type = work_type::transition;
+    } else if (event_type == "ExitStarted") {
+    } else if (event_type == "CurrentSceneTransitionDurationChanged") {
+      nr = val["eventData"]["transitionDuration"].asUInt();
+      type = work_type::duration;
+    } else if (event_type == "SceneItemCreated") {
+      vs.emplace_back(val["eventData"]["sceneItemId"].asString());
+      vs.emplace_back(val["eventData"]["sceneName"].asString());
+      vs.emplace_back(val["eventData"]["sourceName"].asString());
+      vs.emplace_back(val["eventData"]["sourceUuid"].asString());
+      nr = val["eventData"]["sceneItemIndex"].asUInt();
+      type = work_type::new_source;
+    } else if (event_type == "SceneItemRemoved") {
+      vs.emplace_back(val["eventData"]["sceneName"].asString());
+      vs.emplace_back(val["eventData"]["sourceUuid"].asString());
+      type = work_type::remove_source;
+    } else if (event_type == "RecordStateChanged") {
+      vs.emplace_back(val["eventData"]["outputPath"].asString());
+      nr = val["eventData"]["outputActive"].asBool();
+      type = work_type::recording;
+    } else if (event_type == "StreamStateChanged") {
+      nr = val["eventData"]["outputActive"].asBool();
+      type = work_type::streaming;
+    } else if (event_type == "VirtualcamStateChanged") {
+      nr = val["eventData"]["outputActive"].asBool();
+      type = work_type::virtualcam;
+    } else if (event_type == "SceneListChanged") {
+      for (auto& s : val["eventData"]["scenes"])
+        if (s["sceneName"] != "Black")
+          vs.emplace_back(s["sceneName"].asString());
+      type = work_type::sceneschanged;
+    } else if (event_type == "StudioModeStateChanged") {
+      nr = val["eventData"]["studioModeEnabled"].asBool();
+      type = work_type::studiomode;
+    } else if (event_type == "SceneItemEnableStateChanged") {
+      vs.emplace_back(val["eventData"]["sceneName"].asString());
+      vs.emplace_back(val["eventData"]["sceneItemEnabled"].asBool() ? "true" : "false");
+      nr = val["eventData"]["sceneItemId"].asUInt();
+      type = work_type::visible;
+    } else if (event_type == "InputNameChanged") {
+      vs.emplace_back(val["eventData"]["inputUuid"].asString());
+      vs.emplace_back(val["eventData"]["oldInputName"].asString());
+      vs.emplace_back(val["eventData"]["inputName"].asString());
+      type = work_type::sourcename;
+    } else if (event_type == "SceneTransitionEnded") {
+      vs.emplace_back(val["eventData"]["transitionName"].asString());
+      type = work_type::transitionend;
+    } else if (event_type == "SceneItemListReindexed") {
+      vs.emplace_back(val["eventData"]["sceneName"].asString());
+      for (const auto& s : val["eventData"]["sceneItems"]) {
+        vs.emplace_back(s["sceneItemId"].asString());
+        vs.emplace_back(s["sceneItemIndex"].asString());
+      }
+      type = work_type::sourceorder;
+    } else if (event_type == "SceneTransitionStarted" || event_type == "SceneTransitionVideoEnded"
+               || event_type == "SceneItemSelected" || event_type == "SceneNameChanged"
+               || event_type == "InputCreated" || event_type == "InputRemoved"
+               || event_type == "SceneCreated" || event_type == "SceneRemoved"
+               || event_type == "SceneItemTransformChanged" || event_type == "InputSettingsChanged") {
+      // Ignore
+    }
+
+    return { type, nr, std::move(vs) };
+  }
+
+
+  // Conversion of the recorded events into work requests, the way the obsws thread does it
+  // for every event.  The JSON parsing is not included, it is the same for both versions.
+  // The requests are moved into a queue as the real ones are.
+  void bench_events()
+  {
+    std::cout << "\nOBS events (microseconds per event stream, allocations per event)\n"
+              << std::setw(10) << "version" << std::setw(10) << "time" << std::setw(10) << "heap" << '\n';
+
+    Json::Value events;
+    Json::CharReaderBuilder builder;
+    std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+    if (! reader->parse(std::begin(recorded_events), std::end(recorded_events) - 1, &events, nullptr))
+      abort();
+    const auto nevents = events.size();
+
+    auto run = [&](const char* name, auto&& convert) {
+      auto us = measure(convert);
+      auto heap = heap_allocations.load();
+      convert();
+      std::cout << std::setw(10) << name << std::setw(10) << us
+                << std::setw(10) << double(heap_allocations - heap) / nevents << '\n';
+    };
+
+    std::vector<legacy_request> legacy_queue(nevents);
+    run("legacy", [&]{
+      size_t i = 0;
+      for (const auto& e : events)
+        legacy_queue[i++] = legacy_parse(e);
+    });
+
+    std::vector<obs::work_request> queue(nevents);
+    run("typed", [&]{
+      size_t i = 0;
+      for (const auto& e : events)
+        if (auto req = obs::parse_event(e); req && req->type() != obs::work_request::work_type::none)
+          queue[i++] = std::move(*req);
+    });
+  }
+
+
+
+  // The item list of a scene as fetched after these events, in the order OBS sent them:
+  // the list is reindexed, item 4 is created, item 2 removed, and the list reindexed
+  // again.  The worker applies the queued events to the fetched list afterwards.
+  const char fetched_items[] = R"([
+    {"sceneItemId":3,"sceneItemIndex":0,"sourceName":"Webcam","sourceUuid":"c3","sceneItemEnabled":true},
+    {"sceneItemId":1,"sceneItemIndex":1,"sourceName":"Mic","sourceUuid":"a1","sceneItemEnabled":true},
+    {"sceneItemId":4,"sceneItemIndex":2,"sourceName":"Webcam","sourceUuid":"c3","sceneItemEnabled":false}
+  ])";
+  const char stale_events[] = R"([
+    {"eventType":"SceneItemListReindexed","eventData":{"sceneName":"Camera","sceneItems":[{"sceneItemId":1,"sceneItemIndex":0},{"sceneItemId":2,"sceneItemIndex":1},{"sceneItemId":3,"sceneItemIndex":5}]}},
+    {"eventType":"SceneItemCreated","eventData":{"sceneName":"Camera","sceneItemId":4,"sceneItemIndex":7,"sourceName":"Webcam","sourceUuid":"c3"}},
+    {"eventType":"SceneItemRemoved","eventData":{"sceneName":"Camera","sceneItemId":2,"sourceName":"Slides","sourceUuid":"b2"}},
+    {"eventType":"SceneItemListReindexed","eventData":{"sceneName":"Camera","sceneItems":[{"sceneItemId":3,"sceneItemIndex":0},{"sceneItemId":1,"sceneItemIndex":1},{"sceneItemId":4,"sceneItemIndex":2}]}}
+  ])";
+
+
+  // Replay the events against the fetched list the way the worker does.  After every
+  // event all items must be found through both indices, and at the end the list must be
+  // the fetched one.
+  bool check_items()
+  {
+    Json::Value list;
+    Json::Value events;
+    Json::CharReaderBuilder builder;
+    std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+    if (! reader->parse(std::begin(fetched_items), std::end(fetched_items) - 1, &list, nullptr)
+        || ! reader->parse(std::begin(stale_events), std::end(stale_events) - 1, &events, nullptr))
+      abort();
+
+    obs::scene_items items;
+    items.assign(list);
+
+    auto consistent = [&items]{
+      for (size_t idx = 0; idx < items.size(); ++idx) {
+        if (items[idx].id == 0 || items.find(items[idx].id) != idx)
+          return false;
+        auto pos = items.find(items[idx].uuid);
+        if (std::find(pos.begin(), pos.end(), idx) == pos.end())
+          return false;
+      }
+      return true;
+    };
+
+    bool ok = true;
+    for (const auto& e : events) {
+      auto req = obs::parse_event(e);
+      switch (req->type()) {
+      case obs::work_request::work_type::new_source:
+        {
+          auto& r = req->get<obs::work_request::work_type::new_source>();
+          items.insert(r.index, { r.uuid, r.name, r.id, true });
+        }
+        break;
+      case obs::work_request::work_type::remove_source:
+        items.erase(req->get<obs::work_request::work_type::remove_source>().id);
+        break;
+      case obs::work_request::work_type::sourceorder:
+        items.reorder(req->get<obs::work_request::work_type::sourceorder>().items);
+        break;
+      default:
+        abort();
+      }
+      if (! consistent()) {
+        std::cout << "scene items inconsistent after " << e["eventType"].asString() << '\n';
+        ok = false;
+      }
+    }
+
+    const unsigned expected[] = { 3, 1, 4 };
+    if (items.size() != std::size(expected))
+      ok = false;
+    for (size_t idx = 0; ok && idx < items.size(); ++idx)
+      ok = items[idx].id == expected[idx];
+    if (items.find(std::string("c3")).size() != 2 || items.find(std::string("b2")).size() != 0)
+      ok = false;
+
+    std::cout << "\nstale scene item events: " << (ok ? "ok" : "FAILED") << '\n';
+    return ok;
+  }
+
+} // anonymous namespace
+
+
+void* operator new(size_t n)
+{
+  ++heap_allocations;
+  if (auto p = malloc(n ?: 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+
+void operator delete(void* p) noexcept
+{
+  free(p);
+}
+
+
+void operator delete(void* p, size_t) noexcept
+{
+  free(p);
+}
+
+
+// Without arguments all benchmarks are run, otherwise those named.
+int main(int argc, char* argv[])
+{
+  auto selected = [argc, argv](std::string_view name) {
+    if (argc < 2)
+      return true;
+    for (int i = 1; i < argc; ++i)
+      if (name == argv[i])
+        return true;
+    return false;
+  };
+
+  std::cout << std::fixed << std::setprecision(2);
+
+  if (selected("composite"))
+    bench_composite();
+
+  ftlibrary ftobj;
+  if (selected("label"))
+    bench_label(ftobj);
+  if (selected("phases"))
+    bench_phases(ftobj);
+
+  if (selected("events"))
+    bench_events();
+
+  if (selected("items") && ! check_items())
+    return EXIT_FAILURE;
+}
@@ -1,8 +1,10 @@
 #include <cassert>
-#include <numeric>
+#include <cmath>
+#include <span>
 #include <stdexcept>
 
 #include "buttontext.hh"
+#include "composite.hh"
 
 
 #if MagickLibVersion < 0x700
@@ -10,133 +12,130 @@
 #endif
 
 
-// XYZ Debug
-// #include <iostream>
-
-
 // The ImageMagic headers are not really safe for C++, they assume that the enture
 // namespaces are flattened.  This is in this code noticeable with the use of the
 // Quantum type.  Hence include they type in the global namespace.
 using Magick::Quantum;
 
 
-render_to_image::slice::slice(int x_, int y_, FT_GlyphSlot slot)
-: x(x_), y(y_), width(slot->bitmap.width), height(slot->bitmap.rows)
+namespace {
+
+  uint8_t to_char(Quantum q)
+  {
+    return std::lround(std::clamp(double(q), 0.0, double(QuantumRange)) * 255.0 / QuantumRange);
+  }
+
+} // anonymous namespace
+
+
+rgba_buffer::rgba_buffer(const Magick::Image& image)
+: width(image.columns()), height(image.rows()), pixels(width * height * 4)
 {
-  bitmap.resize(width * height);
-  std::copy_n(slot->bitmap.buffer, width * height, bitmap.begin());
+  image.write(0, 0, width, height, "RGBA", Magick::CharPixel, pixels.data());
 }
 
 
-void render_to_image::render(FT_GlyphSlot slot, FT_Int x)
+Magick::Image rgba_buffer::image() const
 {
-  auto bitmap = &slot->bitmap;
-  auto& line = lines.back();
-  auto& slices = line.slices;
-
-  assert(bitmap->pixel_mode == FT_PIXEL_MODE_GRAY);
-  assert(bitmap->num_grays == 256);
-  try {
-    auto& ref = slices.emplace_back(x + slot->bitmap_left, -slot->bitmap_top, slot);
-    line.ymin = std::min(line.ymin, int(slot->bitmap_top - ref.height));
-    line.ymax = std::max(line.ymax, slot->bitmap_top);
-  }
-  catch (std::runtime_error&) {
-    // Ignore.
-  }
+  return Magick::Image(width, height, "RGBA", Magick::CharPixel, pixels.data());
 }
 
 
-std::pair<double,FT_UInt> render_to_image::first_font_size()
+void render_base::start()
 {
-  experiments.clear();
-  return { current_fontsize = 24.0, 122 };
+  if (nlines == lines.size()) {
+    if (lines.size() == lines.capacity())
+      ++nallocations;
+    lines.emplace_back();
+  } else {
+    auto& line = lines[nlines];
+    line.slices.clear();
+    line.ymin = std::numeric_limits<int>::max();
+    line.ymax = std::numeric_limits<int>::min();
+  }
+  ++nlines;
 }
 
 
-void render_to_image::compute_dimensions()
+void render_base::render(const ftglyph& glyph, FT_Int x)
 {
-  std::vector<unsigned> widths;
-  std::vector<unsigned> heights;
-  for (auto& line : lines) {
-    auto& slices = line.slices;
-    widths.emplace_back(slices.back().x + slices.back().width - slices.front().x);
-    heights.emplace_back(line.ymax - line.ymin + 1);
+  auto& line = lines[nlines - 1];
+  auto& slices = line.slices;
+
+  auto size = glyph.bitmap.size();
+  if (arena_used + size > arena.size()) {
+    arena.resize(std::max(2 * arena.size(), arena_used + size));
+    ++nallocations;
   }
-  assert(widths.size() == heights.size());
+  std::copy(glyph.bitmap.begin(), glyph.bitmap.end(), arena.begin() + arena_used);
 
-  maxwidth = std::accumulate(widths.begin(), widths.end(), 0u, [](const auto l, const auto r){ return std::max(l, r); });
-  totalheight = std::accumulate(heights.begin(), heights.end(), 0u);
-  // Account for line separation.
-  linesep = std::max(1u, unsigned(frac_linesep * totalheight / heights.size() + 0.5));
-  totalheight += (heights.size() - 1) * linesep;
+  if (slices.size() == slices.capacity())
+    ++nallocations;
+  auto& ref = slices.emplace_back(x + glyph.left, -glyph.top, glyph.width, glyph.rows, arena_used);
+  arena_used += size;
 
-  // std::cout << "#lines = " << lines.size() << "  maxwidth = " << maxwidth << " (target: " << targetwidth << ")   totalheight = " << totalheight << " (target: " << targetheight << ")  linesep = " << linesep << "\n";
+  line.ymin = std::min(line.ymin, int(glyph.top - ref.height));
+  line.ymax = std::max(line.ymax, glyph.top);
 }
 
 
-std::pair<bool,double> render_to_image::check_size()
+std::pair<double,FT_UInt> render_base::first_font_size()
 {
-  if (goodenough(maxwidth, totalheight))
-    return { true, current_fontsize };
-
-  if (experiments.empty()) {
-    experiments.emplace_back(current_fontsize, maxwidth, totalheight);
-    double f = std::min(targetwidth / double(maxwidth), targetheight / double(totalheight));
-    current_fontsize *= f;
-  } else {
-    if (maxwidth < std::get<1>(experiments[0]) || (maxwidth == std::get<1>(experiments[0]) && totalheight <= std::get<2>(experiments[0])))
-      experiments.emplace(experiments.begin(), std::make_tuple(current_fontsize, maxwidth, totalheight));
-    else if (experiments.size() == 1)
-      experiments.emplace_back(std::make_tuple(current_fontsize, maxwidth, totalheight));
-    else {
-      if (maxwidth < std::get<1>(experiments.back()) || (maxwidth == std::get<1>(experiments.back()) && totalheight < std::get<2>(experiments.back())))
-        experiments[1] = experiment_type{ current_fontsize, maxwidth, totalheight };
-      else
-        return { true, std::get<0>(experiments.back()) };
-    }
-
-    auto ds = std::get<0>(experiments.back()) - std::get<0>(experiments[0]);
-    auto dw = std::get<1>(experiments.back()) - std::get<1>(experiments[0]);
-    auto dh = std::get<2>(experiments.back()) - std::get<2>(experiments[0]);
+  return { current_fontsize = 24.0, 122 };
+}
 
-    auto ew = targetwidth - std::get<1>(experiments[0]);
-    auto eh = targetheight - std::get<2>(experiments[0]);
 
-    current_fontsize = std::min(ds / dw * (ew + dw / ds * std::get<0>(experiments[0])),
-                                ds / dh * (eh + dh / ds * std::get<0>(experiments[0])));
+void render_base::compute_dimensions()
+{
+  maxwidth = 0;
+  totalheight = 0;
+  for (const auto& line : std::span(lines.data(), nlines)) {
+    auto& slices = line.slices;
+    maxwidth = std::max(maxwidth, unsigned(slices.back().x + slices.back().width - slices.front().x));
+    totalheight += line.ymax - line.ymin + 1;
   }
 
-  // std::cout << "new font size " << current_fontsize << std::endl;
-
-  return { false, current_fontsize };
+  // Account for line separation.
+  linesep = std::max(1u, unsigned(frac_linesep * totalheight / nlines + 0.5));
+  totalheight += (nlines - 1) * linesep;
 }
 
 
-bool render_to_image::goodenough(unsigned w, unsigned h) const
+double render_base::fit_font_size(unsigned measure_scale)
 {
-  return w <= targetwidth && h <= targetheight && (w >= unsigned(0.99 * targetwidth) || h >= unsigned(0.99 * targetheight));
+  // The dimensions were measured with a resolution MEASURE_SCALE times higher than used
+  // for rendering.  Leave room for rounding the glyph bitmaps and the line separation to
+  // whole pixels.
+  double f = std::min(double(targetwidth - std::min(targetwidth, 2u)) * measure_scale / maxwidth,
+                      double(targetheight - std::min(targetheight, unsigned(nlines + 1))) * measure_scale / totalheight);
+  return current_fontsize *= f;
 }
 
 
-Magick::Image render_to_image::finish(Magick::Color foreground, double posx, double posy)
+std::pair<bool,double> render_base::check_size()
 {
-  Magick::Image image(background);
-  image.modifyImage();
+  if (maxwidth <= targetwidth && totalheight <= targetheight)
+    return { true, current_fontsize };
+
+  // Rounding to whole pixels made the text slightly too large.  Make sure the size is
+  // reduced noticeably so that the loop terminates quickly.
+  current_fontsize *= std::min(0.99, std::min(targetwidth / double(maxwidth), targetheight / double(totalheight)));
+
+  return { false, current_fontsize };
+}
 
-  assert(image.alpha());
-  assert(image.channels() == 4);
 
-  auto imwidth = image.columns();
-  auto imheight = image.rows();
-  auto mem = image.getPixels(0, 0, imwidth, imheight);
-  auto foreground_red = foreground.quantumRed();
-  auto foreground_green = foreground.quantumGreen();
-  auto foreground_blue = foreground.quantumBlue();
+void render_base::composite(uint8_t* mem, unsigned imwidth, unsigned imheight, const Magick::Color& foreground, double posx, double posy) const
+{
+  // Text is blended into pixels with 8-bit channels.  This is the resolution of the devices
+  // and it allows to use the vectorized code.  Where glyphs overlap the intermediate result
+  // is rounded as well.  For almost transparent pixels this can change the color by a few
+  // units more than the tolerance documented in composite.hh.
+  composite_color fg{ to_char(foreground.quantumRed()), to_char(foreground.quantumGreen()), to_char(foreground.quantumBlue()) };
 
   int offy = std::max(0, int((imheight - totalheight) * posy));
 
-  for (auto& line : lines) {
+  for (const auto& line : std::span(lines.data(), nlines)) {
     auto& slices = line.slices;
     auto& ymin = line.ymin;
     auto& ymax = line.ymax;
@@ -148,64 +147,43 @@ Magick::Image render_to_image::finish(Magick::Color foreground, double posx, dou
 
     auto s0x = slices.front().x;
     for (const auto& s : slices) {
-      for (unsigned y = 0; y < s.height; ++y) {
-        assert(s.x - s0x + s.width <= width);
+      assert(s.x - s0x + s.width <= width);
 
-        if (offy + s.y + ymax + y > imheight)
+      // Clip the slice horizontally.
+      int memx = offx + s.x - s0x;
+      unsigned skip = std::max(0, -memx);
+      if (skip >= s.width || memx >= int(imwidth))
+        continue;
+      unsigned n = std::min(s.width - skip, unsigned(imwidth - memx - skip));
+
+      for (unsigned y = 0; y < s.height; ++y) {
+        auto memy = offy + s.y + ymax + y;
+        if (memy >= imheight)
           break;
 
-        for (unsigned x = 0; x < s.width; ++x) {
-          auto offset = y * s.width + x;
-
-          auto memx = offx + s.x - s0x + x;
-          auto memy = offy + s.y + ymax + y;
-          if (memx >= imwidth)
-            continue;
-
-
-          auto foreground_alpha = QuantumRange * s.bitmap[offset] / 255;
-
-          auto memoffset = (memy * imwidth + memx) * 4;
-          Quantum red = mem[memoffset];
-          Quantum green = mem[memoffset + 1];
-          Quantum blue = mem[memoffset + 2];
-          Quantum opacity = mem[memoffset + 3];
-          if (opacity != 0 && foreground_alpha != 0) {
-            // This code is a mess.  It implements alpha-blending but with three different units
-            // this gets complicated.  Opaqueness in the alpha-blending formula assumes a range
-            // of 0.0 (transparent) to 1.0 (completely opaque).  The ImageMagick library uses a
-            // range from 0 (transparent) to QuantumRange (completely opaque).  Note that
-            // QuantumRange depends in value and type on the libraries configuration.
-            // Finally, the freetype library uses an opaqueness value from 0 to an upper value
-            // based on the image format.  We use 256 gray levels and therefore the range is 0 to 255.
-            auto alphamem = opacity / double(QuantumRange);
-            opacity = foreground_alpha * opacity / double(QuantumRange);
-
-            auto alphares = 1.0 - opacity / double(QuantumRange);
-            auto alphatext = s.bitmap[offset] / 255.0;
-
-            red = 1.0 / alphares * (alphatext * foreground_red + (1.0 - alphatext) * alphamem * red);
-            green = 1.0 / alphares * (alphatext * foreground_green + (1.0 - alphatext) * alphamem * green);
-            blue = 1.0 / alphares * (alphatext * foreground_blue + (1.0 - alphatext) * alphamem * blue);
-          } else if (opacity == 0) {
-            red = foreground_red;
-            green = foreground_green;
-            blue = foreground_blue;
-            opacity = foreground_alpha;
-          }
-
-          mem[memoffset] = red;
-          mem[memoffset + 1] = green;
-          mem[memoffset + 2] = blue;
-          mem[memoffset + 3] = opacity;
-        }
+        composite_row(&mem[(memy * imwidth + memx + skip) * 4], &arena[s.offset + y * s.width + skip], n, fg);
       }
     }
 
     offy += height + linesep;
   }
+}
 
-  image.syncPixels();
 
-  return image;
+Magick::Image render_to_image::finish(const Magick::Color& foreground, double posx, double posy)
+{
+  rgba_buffer buf(background);
+  composite(buf.pixels.data(), buf.width, buf.height, foreground, posx, posy);
+  return buf.image();
+}
+
+
+const rgba_buffer& render_to_rgba_buffer::finish(const Magick::Color& foreground, double posx, double posy)
+{
+  // Once the target has the right size this does not allocate memory.
+  target.width = background.width;
+  target.height = background.height;
+  target.pixels.assign(background.pixels.begin(), background.pixels.end());
+  composite(target.pixels.data(), target.width, target.height, foreground, posx, posy);
+  return target;
 }
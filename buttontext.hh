@@ -11,64 +11,119 @@
 #include FT_FREETYPE_H
 #include <Magick++.h>
 
+#include "ftlibrary.hh"
 
-struct render_to_image {
-  render_to_image(const Magick::Color& background_, unsigned targetwidth_, unsigned targetheight_)
-  : background(Magick::Geometry(targetwidth_, targetheight_), background_), targetwidth(targetwidth_ ?: std::numeric_limits<unsigned>::max()), targetheight(targetheight_ ?: std::numeric_limits<unsigned>::max())
-  {
-  }
 
-  render_to_image(const Magick::Image& background_, double widthfactor = 1.0, double heightfactor = 1.0)
-  : background(background_), targetwidth(background.columns() * std::clamp(widthfactor, 0.0, 1.0)), targetheight(background.rows() * std::clamp(heightfactor, 0.0, 1.0))
+// Key image in the format used for blending text: 8-bit RGBA values, row by row.  A
+// buffer is allocated once per key and reused for every update.  This is not the format
+// of the device.  The upload still goes through a Magick::Image which streamdeckpp
+// converts, rotates, and encodes for the device; only the rendering avoids Magick.
+struct rgba_buffer {
+  rgba_buffer() = default;
+  explicit rgba_buffer(const Magick::Image& image);
+
+  Magick::Image image() const;
+
+  unsigned width = 0;
+  unsigned height = 0;
+  std::vector<uint8_t> pixels;
+};
+
+
+// Layout of the text, independent of the target of the rendering.
+struct render_base {
+  render_base(unsigned targetwidth_, unsigned targetheight_)
+  : targetwidth(targetwidth_ ?: std::numeric_limits<unsigned>::max()), targetheight(targetheight_ ?: std::numeric_limits<unsigned>::max())
   {
   }
 
-  void start() { lines.emplace_back(); }
+  void start();
 
-  void operator()(FT_GlyphSlot slot, FT_Int x){ render(slot, x); }
+  void operator()(const ftglyph& glyph, FT_Int x){ render(glyph, x); }
 
   std::pair<double,FT_UInt> first_font_size();
   void compute_dimensions();
+  double fit_font_size(unsigned measure_scale);
   std::pair<bool,double> check_size();
 
-  bool goodenough(unsigned w, unsigned h) const;
-
-  Magick::Image finish(Magick::Color foreground = Magick::Color("black"), double posx = 0.5, double posy = 0.5);
-
+  // The storage of lines and glyph bitmaps is kept for the next rendering.
   void reset() {
-    lines.clear();
+    nlines = 0;
+    arena_used = 0;
   }
 
+  // Number of times the storage for lines, glyphs, and bitmaps had to grow.  Once an
+  // object has been used for a few renders this number does not change anymore.
+  size_t allocations() const { return nallocations; }
+
+protected:
+  // Blend the text into the RGBA pixels in MEM.
+  void composite(uint8_t* mem, unsigned imwidth, unsigned imheight, const Magick::Color& foreground, double posx, double posy) const;
+
 private:
-  void render(FT_GlyphSlot slot, FT_Int x);
+  void render(const ftglyph& glyph, FT_Int x);
 
-  // Magick::Color background;
-  Magick::Image background;
   unsigned targetwidth;
   unsigned targetheight;
 
   double current_fontsize = 0;
-  using experiment_type = std::tuple<double,unsigned,unsigned>;
-  std::vector<experiment_type> experiments;
+  // The bitmaps of all glyphs are stored one after the other in ARENA.
   struct slice {
-    slice(int x_, int y_, FT_GlyphSlot slot_);
-
     int x;
     int y;
     unsigned width;
     unsigned height;
-    std::vector<uint8_t> bitmap;
+    size_t offset;
   };
   struct line_type {
     std::vector<slice> slices;
     int ymin = std::numeric_limits<int>::max();
     int ymax = std::numeric_limits<int>::min();
   };
+  // Only the first NLINES elements are in use.
   std::vector<line_type> lines;
+  size_t nlines = 0;
+  std::vector<uint8_t> arena;
+  size_t arena_used = 0;
+  size_t nallocations = 0;
   static constexpr double frac_linesep = 0.15;
   unsigned maxwidth = 0;
   unsigned totalheight = 0;
   unsigned linesep = 0;
 };
 
+
+struct render_to_image : render_base {
+  render_to_image(const Magick::Color& background_, unsigned targetwidth_, unsigned targetheight_)
+  : render_base(targetwidth_, targetheight_), background(Magick::Geometry(targetwidth_, targetheight_), background_)
+  {
+  }
+
+  render_to_image(const Magick::Image& background_, double widthfactor = 1.0, double heightfactor = 1.0)
+  : render_base(background_.columns() * std::clamp(widthfactor, 0.0, 1.0), background_.rows() * std::clamp(heightfactor, 0.0, 1.0)), background(background_)
+  {
+  }
+
+  Magick::Image finish(const Magick::Color& foreground = Magick::Color("black"), double posx = 0.5, double posy = 0.5);
+
+private:
+  Magick::Image background;
+};
+
+
+// Render into a preallocated buffer without creating intermediate Magick::Image objects.
+// The background is copied, not blended.
+struct render_to_rgba_buffer : render_base {
+  render_to_rgba_buffer(const rgba_buffer& background_, rgba_buffer& target_, double widthfactor = 1.0, double heightfactor = 1.0)
+  : render_base(background_.width * std::clamp(widthfactor, 0.0, 1.0), background_.height * std::clamp(heightfactor, 0.0, 1.0)), background(background_), target(target_)
+  {
+  }
+
+  const rgba_buffer& finish(const Magick::Color& foreground = Magick::Color("black"), double posx = 0.5, double posy = 0.5);
+
+private:
+  const rgba_buffer& background;
+  rgba_buffer& target;
+};
+
 #endif // buttontext.hh
@@ -0,0 +1,183 @@
+#include <algorithm>
+#include <cstring>
+
+#include "composite.hh"
+
+#if defined __x86_64__ || defined __i386__
+# include <immintrin.h>
+#endif
+
+
+// All implementations compute the numerator and the denominator of the color formula
+// exactly, the values fit into the mantissa of a float.  There is no integer division in
+// the vector units.  Instead the reciprocal of the denominator is computed once per pixel
+// in single precision and multiplied with the numerators of the three channels.  Because
+// the operations and their order are the same everywhere the results do not depend on the
+// implementation.
+
+
+void composite_row_scalar(uint8_t* rgba, const uint8_t* coverage, unsigned n, const composite_color& fg)
+{
+  const float fg255[3] = { 255.0f * fg.r, 255.0f * fg.g, 255.0f * fg.b };
+
+  for (unsigned i = 0; i < n; ++i, rgba += 4) {
+    auto c = coverage[i];
+    if (rgba[3] == 0) {
+      rgba[0] = fg.r;
+      rgba[1] = fg.g;
+      rgba[2] = fg.b;
+      rgba[3] = c;
+      continue;
+    }
+    if (c == 0)
+      continue;
+
+    float cf = c;
+    float ca = cf * rgba[3];
+    float recip = 1.0f / std::max(65025.0f - ca, 1.0f);
+    float rest = (255.0f - cf) * rgba[3];
+    for (unsigned j = 0; j < 3; ++j)
+      rgba[j] = uint8_t(std::min((cf * fg255[j] + rest * rgba[j]) * recip + 0.5f, 255.0f));
+    rgba[3] = uint8_t(ca * (1.0f / 255.0f) + 0.5f);
+  }
+}
+
+
+#if defined __x86_64__ || defined __i386__
+namespace {
+
+  // One color channel of four or eight pixels, starting at bit SHIFT of the pixel values.
+  __attribute__((target("sse2"))) inline __m128i channel_sse2(__m128i px, int shift, __m128 cf, __m128 fg255, __m128 rest, __m128 recip)
+  {
+    __m128 bg = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, shift), _mm_set1_epi32(0xff)));
+    __m128 q = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(cf, fg255), _mm_mul_ps(rest, bg)), recip);
+    return _mm_slli_epi32(_mm_cvttps_epi32(_mm_min_ps(_mm_add_ps(q, _mm_set1_ps(0.5f)), _mm_set1_ps(255.0f))), shift);
+  }
+
+
+  __attribute__((target("avx2"))) inline __m256i channel_avx2(__m256i px, int shift, __m256 cf, __m256 fg255, __m256 rest, __m256 recip)
+  {
+    __m256 bg = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(px, shift), _mm256_set1_epi32(0xff)));
+    __m256 q = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(cf, fg255), _mm256_mul_ps(rest, bg)), recip);
+    return _mm256_slli_epi32(_mm256_cvttps_epi32(_mm256_min_ps(_mm256_add_ps(q, _mm256_set1_ps(0.5f)), _mm256_set1_ps(255.0f))), shift);
+  }
+
+} // anonymous namespace
+
+
+__attribute__((target("sse2")))
+void composite_row_sse2(uint8_t* rgba, const uint8_t* coverage, unsigned n, const composite_color& fg)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i fgpixel = _mm_set1_epi32(fg.r | (fg.g << 8) | (fg.b << 16));
+  const __m128 fg255r = _mm_set1_ps(255.0f * fg.r);
+  const __m128 fg255g = _mm_set1_ps(255.0f * fg.g);
+  const __m128 fg255b = _mm_set1_ps(255.0f * fg.b);
+  const __m128 f65025 = _mm_set1_ps(65025.0f);
+  const __m128 f255 = _mm_set1_ps(255.0f);
+  const __m128 f1 = _mm_set1_ps(1.0f);
+  const __m128 fhalf = _mm_set1_ps(0.5f);
+  const __m128 f1_255 = _mm_set1_ps(1.0f / 255.0f);
+
+  unsigned i = 0;
+  for (; i + 4 <= n; i += 4, rgba += 16) {
+    uint32_t cov4;
+    memcpy(&cov4, coverage + i, sizeof(cov4));
+    __m128i px = _mm_loadu_si128((const __m128i*) rgba);
+    __m128i a = _mm_srli_epi32(px, 24);
+    __m128i transparent = _mm_cmpeq_epi32(a, zero);
+    // Glyph bitmaps have wide empty margins.
+    if (cov4 == 0 && _mm_movemask_epi8(transparent) == 0)
+      continue;
+
+    __m128i cv = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(cov4), zero), zero);
+
+    __m128 cf = _mm_cvtepi32_ps(cv);
+    __m128 af = _mm_cvtepi32_ps(a);
+    __m128 ca = _mm_mul_ps(cf, af);
+    __m128 recip = _mm_div_ps(f1, _mm_max_ps(_mm_sub_ps(f65025, ca), f1));
+    __m128 rest = _mm_mul_ps(_mm_sub_ps(f255, cf), af);
+
+    __m128i res = _mm_or_si128(_mm_or_si128(channel_sse2(px, 0, cf, fg255r, rest, recip),
+                                            channel_sse2(px, 8, cf, fg255g, rest, recip)),
+                               channel_sse2(px, 16, cf, fg255b, rest, recip));
+    __m128i ares = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(ca, f1_255), fhalf));
+    res = _mm_or_si128(res, _mm_slli_epi32(ares, 24));
+
+    // Pixels without coverage remain unchanged, transparent pixels get the text color.
+    __m128i nocov = _mm_cmpeq_epi32(cv, zero);
+    res = _mm_or_si128(_mm_and_si128(nocov, px), _mm_andnot_si128(nocov, res));
+    __m128i fgres = _mm_or_si128(fgpixel, _mm_slli_epi32(cv, 24));
+    res = _mm_or_si128(_mm_and_si128(transparent, fgres), _mm_andnot_si128(transparent, res));
+
+    _mm_storeu_si128((__m128i*) rgba, res);
+  }
+
+  composite_row_scalar(rgba, coverage + i, n - i, fg);
+}
+
+
+__attribute__((target("avx2")))
+void composite_row_avx2(uint8_t* rgba, const uint8_t* coverage, unsigned n, const composite_color& fg)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i fgpixel = _mm256_set1_epi32(fg.r | (fg.g << 8) | (fg.b << 16));
+  const __m256 fg255r = _mm256_set1_ps(255.0f * fg.r);
+  const __m256 fg255g = _mm256_set1_ps(255.0f * fg.g);
+  const __m256 fg255b = _mm256_set1_ps(255.0f * fg.b);
+  const __m256 f65025 = _mm256_set1_ps(65025.0f);
+  const __m256 f255 = _mm256_set1_ps(255.0f);
+  const __m256 f1 = _mm256_set1_ps(1.0f);
+  const __m256 fhalf = _mm256_set1_ps(0.5f);
+  const __m256 f1_255 = _mm256_set1_ps(1.0f / 255.0f);
+
+  unsigned i = 0;
+  for (; i + 8 <= n; i += 8, rgba += 32) {
+    uint64_t cov8;
+    memcpy(&cov8, coverage + i, sizeof(cov8));
+    __m256i px = _mm256_loadu_si256((const __m256i*) rgba);
+    __m256i a = _mm256_srli_epi32(px, 24);
+    __m256i transparent = _mm256_cmpeq_epi32(a, zero);
+    if (cov8 == 0 && _mm256_movemask_epi8(transparent) == 0)
+      continue;
+
+    __m256i cv = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (coverage + i)));
+
+    __m256 cf = _mm256_cvtepi32_ps(cv);
+    __m256 af = _mm256_cvtepi32_ps(a);
+    __m256 ca = _mm256_mul_ps(cf, af);
+    __m256 recip = _mm256_div_ps(f1, _mm256_max_ps(_mm256_sub_ps(f65025, ca), f1));
+    __m256 rest = _mm256_mul_ps(_mm256_sub_ps(f255, cf), af);
+
+    __m256i res = _mm256_or_si256(_mm256_or_si256(channel_avx2(px, 0, cf, fg255r, rest, recip),
+                                                  channel_avx2(px, 8, cf, fg255g, rest, recip)),
+                                  channel_avx2(px, 16, cf, fg255b, rest, recip));
+    __m256i ares = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(ca, f1_255), fhalf));
+    res = _mm256_or_si256(res, _mm256_slli_epi32(ares, 24));
+
+    res = _mm256_blendv_epi8(res, px, _mm256_cmpeq_epi32(cv, zero));
+    res = _mm256_blendv_epi8(res, _mm256_or_si256(fgpixel, _mm256_slli_epi32(cv, 24)), transparent);
+
+    _mm256_storeu_si256((__m256i*) rgba, res);
+  }
+
+  // The compiler does not reliably do this for functions with a target attribute.  Without
+  // it the non-VEX code which follows is slowed down considerably.
+  _mm256_zeroupper();
+
+  composite_row_scalar(rgba, coverage + i, n - i, fg);
+}
+#endif
+
+
+composite_row_fn composite_row_select()
+{
+#if defined __x86_64__ || defined __i386__
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return composite_row_avx2;
+  if (__builtin_cpu_supports("sse2"))
+    return composite_row_sse2;
+#endif
+  return composite_row_scalar;
+}
@@ -0,0 +1,46 @@
+#ifndef _COMPOSITE_HH
+#define _COMPOSITE_HH 1
+
+#include <cstdint>
+
+
+// Blending of rendered text into key images.  The pixels are stored as 8-bit RGBA values,
+// the coverage of the text as 256 gray levels as produced by FreeType.  For a pixel with
+// coverage C and alpha A (both scaled to 0.0 ... 1.0) the result is
+//
+//   A' = C * A
+//   X' = (C * Xtext + (1 - C) * A * X) / (1 - C * A)      for X in { R, G, B }
+//
+// with X' saturated at the maximum.  Where C * A is 1 the channel is zero if the text
+// channel is zero and saturated otherwise, as with the division by zero in the floating-
+// point code.  A fully transparent pixel gets the text
+// color and C as the alpha value, other pixels without coverage are not changed.  This is
+// the formula the original floating-point loop in render_to_image::finish used.  All
+// implementations produce identical results which differ from the double-precision
+// computation with 16-bit quantums by at most one in each channel.
+struct composite_color {
+  uint8_t r;
+  uint8_t g;
+  uint8_t b;
+};
+
+
+using composite_row_fn = void (*)(uint8_t* rgba, const uint8_t* coverage, unsigned n, const composite_color& fg);
+
+void composite_row_scalar(uint8_t* rgba, const uint8_t* coverage, unsigned n, const composite_color& fg);
+#if defined __x86_64__ || defined __i386__
+void composite_row_sse2(uint8_t* rgba, const uint8_t* coverage, unsigned n, const composite_color& fg);
+void composite_row_avx2(uint8_t* rgba, const uint8_t* coverage, unsigned n, const composite_color& fg);
+#endif
+
+// The best implementation for the CPU the code is running on.
+composite_row_fn composite_row_select();
+
+
+inline void composite_row(uint8_t* rgba, const uint8_t* coverage, unsigned n, const composite_color& fg)
+{
+  static const composite_row_fn fct = composite_row_select();
+  fct(rgba, coverage, n, fg);
+}
+
+#endif // composite.hh
@@ -0,0 +1,95 @@
+#include <string_view>
+
+#include "events.hh"
+
+
+namespace obs {
+
+  namespace {
+
+    // Events which are sent by OBS but need no handling.
+    constexpr std::string_view ignored_events[] = {
+      "ExitStarted",
+      "SceneTransitionStarted",
+      "SceneTransitionVideoEnded",
+      "SceneItemSelected",
+      "SceneNameChanged",
+      "InputCreated",
+      "InputRemoved",
+      "SceneCreated",
+      "SceneRemoved",
+      "SceneItemTransformChanged",
+      "InputSettingsChanged",
+    };
+
+
+    // The string in V without a copy.
+    std::string_view view(const Json::Value& v)
+    {
+      const char* begin;
+      const char* end;
+      if (! v.isString() || ! v.getString(&begin, &end))
+        return { };
+      return std::string_view(begin, end - begin);
+    }
+
+  } // anonymous namespace
+
+
+  std::optional<work_request> parse_event(const Json::Value& val)
+  {
+    using work_type = work_request::work_type;
+
+    const auto& data = val["eventData"];
+    auto event_type = view(val["eventType"]);
+
+    if (event_type == "CurrentProgramSceneChanged")
+      return work_request::make<work_type::scene>({ data["sceneName"].asString() });
+    if (event_type == "CurrentPreviewSceneChanged")
+      return work_request::make<work_type::preview>({ data["sceneName"].asString() });
+    if (event_type == "CurrentSceneTransitionChanged")
+      return work_request::make<work_type::transition>({ data["transitionName"].asString() });
+    if (event_type == "CurrentSceneTransitionDurationChanged")
+      return work_request::make<work_type::duration>({ data["transitionDuration"].asUInt() });
+    if (event_type == "SceneItemCreated")
+      return work_request::make<work_type::new_source>({ data["sceneName"].asString(), data["sceneItemId"].asUInt(), data["sceneItemIndex"].asUInt(), data["sourceName"].asString(), data["sourceUuid"].asString() });
+    if (event_type == "SceneItemRemoved")
+      return work_request::make<work_type::remove_source>({ data["sceneName"].asString(), data["sceneItemId"].asUInt() });
+    if (event_type == "RecordStateChanged")
+      return work_request::make<work_type::recording>({ data["outputActive"].asBool(), data["outputPath"].asString() });
+    if (event_type == "StreamStateChanged")
+      return work_request::make<work_type::streaming>({ data["outputActive"].asBool() });
+    if (event_type == "VirtualcamStateChanged")
+      return work_request::make<work_type::virtualcam>({ data["outputActive"].asBool() });
+    if (event_type == "SceneListChanged") {
+      work_request::scenes_data res;
+      res.names.reserve(data["scenes"].size());
+      for (const auto& s : data["scenes"])
+        if (view(s["sceneName"]) != "Black")
+          res.names.emplace_back(s["sceneName"].asString());
+      return work_request::make<work_type::sceneschanged>(std::move(res));
+    }
+    if (event_type == "StudioModeStateChanged")
+      return work_request::make<work_type::studiomode>({ data["studioModeEnabled"].asBool() });
+    if (event_type == "SceneItemEnableStateChanged")
+      return work_request::make<work_type::visible>({ data["sceneName"].asString(), data["sceneItemId"].asUInt(), data["sceneItemEnabled"].asBool() });
+    if (event_type == "InputNameChanged")
+      return work_request::make<work_type::sourcename>({ data["inputUuid"].asString(), data["oldInputName"].asString(), data["inputName"].asString() });
+    if (event_type == "SceneTransitionEnded")
+      return work_request::make<work_type::transitionend>({ data["transitionName"].asString() });
+    if (event_type == "SceneItemListReindexed") {
+      work_request::order_data res{ data["sceneName"].asString(), { } };
+      res.items.reserve(data["sceneItems"].size());
+      for (const auto& s : data["sceneItems"])
+        res.items.emplace_back(s["sceneItemId"].asUInt(), s["sceneItemIndex"].asUInt());
+      return work_request::make<work_type::sourceorder>(std::move(res));
+    }
+
+    for (auto e : ignored_events)
+      if (event_type == e)
+        return work_request();
+
+    return std::nullopt;
+  }
+
+} // namespace obs
@@ -0,0 +1,146 @@
+#ifndef _EVENTS_HH
+#define _EVENTS_HH 1
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include <json/json.h>
+
+
+namespace obs {
+
+  // Work for the worker thread, mostly derived from OBS events.  Every type of request has
+  // its own payload type; numbers and flags are kept as such and not converted to text.
+  struct work_request {
+    enum struct work_type {
+        none,
+        new_session,
+        buttons,
+        scene,
+        visible,
+        preview,
+        transition,
+        new_scene,
+        delete_scene,
+        recording,
+        streaming,
+        virtualcam,
+        sceneschanged,
+        studiomode,
+        sourcename,
+        transitionend,
+        duration,
+        sourceorder,
+        new_source,
+        remove_source,
+        ftb_frame,
+        toggle_source,
+    };
+
+    struct no_data { };
+    struct name_data {
+      std::string name;
+    };
+    struct visible_data {
+      std::string scene;
+      unsigned id;
+      bool enabled;
+    };
+    struct flag_data {
+      bool on;
+    };
+    struct recording_data {
+      bool active;
+      std::string path;
+    };
+    struct scenes_data {
+      std::vector<std::string> names;
+    };
+    struct rename_data {
+      std::string uuid;
+      std::string old_name;
+      std::string name;
+    };
+    struct duration_data {
+      unsigned ms;
+    };
+    struct order_data {
+      std::string scene;
+      // Pairs of scene item ID and new index.
+      std::vector<std::pair<unsigned,unsigned>> items;
+    };
+    struct new_source_data {
+      std::string scene;
+      unsigned id;
+      unsigned index;
+      std::string name;
+      std::string uuid;
+    };
+    struct remove_source_data {
+      std::string scene;
+      unsigned id;
+    };
+    struct key_data {
+      unsigned nr;
+    };
+
+    // The payloads in the order of the request types.
+    using payload_type = std::variant<
+      no_data,             // none
+      no_data,             // new_session
+      no_data,             // buttons
+      name_data,           // scene
+      visible_data,        // visible
+      name_data,           // preview
+      name_data,           // transition
+      name_data,           // new_scene
+      name_data,           // delete_scene
+      recording_data,      // recording
+      flag_data,           // streaming
+      flag_data,           // virtualcam
+      scenes_data,         // sceneschanged
+      flag_data,           // studiomode
+      rename_data,         // sourcename
+      name_data,           // transitionend
+      duration_data,       // duration
+      order_data,          // sourceorder
+      new_source_data,     // new_source
+      remove_source_data,  // remove_source
+      no_data,             // ftb_frame
+      key_data             // toggle_source
+    >;
+    static_assert(std::variant_size_v<payload_type> == size_t(work_type::toggle_source) + 1);
+
+    template<work_type T>
+    using data_type = std::variant_alternative_t<size_t(T),payload_type>;
+
+    work_request() = default;
+    template<work_type T>
+    static work_request make(data_type<T>&& data = { }) { return work_request(std::in_place_index<size_t(T)>, std::move(data)); }
+
+    work_type type() const { return work_type(payload.index()); }
+
+    template<work_type T>
+    auto& get() { return std::get<size_t(T)>(payload); }
+    template<work_type T>
+    const auto& get() const { return std::get<size_t(T)>(payload); }
+
+  private:
+    template<size_t I, typename T>
+    work_request(std::in_place_index_t<I> i, T&& data) : payload(i, std::forward<T>(data)) { }
+
+    payload_type payload;
+  };
+
+
+  // Translate an event sent by OBS.  Events which need no handling result in a request of
+  // type none, unknown events in no request at all.
+  std::optional<work_request> parse_event(const Json::Value& val);
+
+} // namespace obs
+
+#endif // events.hh
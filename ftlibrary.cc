@@ -1,22 +1,38 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
 #include <stdexcept>
 
 #include "ftlibrary.hh"
+#include "startup.hh"
+
+#include FT_MODULE_H
+#include FT_OUTLINE_H
+
+// The SDF renderers were added in FreeType 2.11.
+#if FREETYPE_MAJOR > 2 || (FREETYPE_MAJOR == 2 && FREETYPE_MINOR >= 11)
+# define HAVE_FT_SDF 1
+#endif
 
 using namespace std::string_literals;
 
 
-ftlibrary::ftlibrary()
+ftlibrary::ftlibrary(size_t glyph_cache_size)
+: glyphs(glyph_cache_size)
 {
   auto error = FT_Init_FreeType(&library);
   if (error)
     throw std::runtime_error("failed to initialize freetype2");
-  fcconfig = FcInitLoadConfigAndFonts();
+  fcconfig = std::async(std::launch::async, []{
+    startup::scope timing("load fonts");
+    return FcInitLoadConfigAndFonts();
+  }).share();
 }
 
 
 ftlibrary::~ftlibrary()
 {
-  FcConfigDestroy(fcconfig);
+  FcConfigDestroy(fcconfig.get());
   FcFini();
   FT_Done_FreeType(library);
 }
@@ -33,15 +49,39 @@ ftface& ftlibrary::find_font(const std::string& fontface)
 }
 
 
+bool ftlibrary::enable_sdf()
+{
+#ifdef HAVE_FT_SDF
+  FT_Int spread = sdf_atlas::spread;
+  if (FT_Property_Set(library, "sdf", "spread", &spread) != 0 || FT_Property_Set(library, "bsdf", "spread", &spread) != 0)
+    return false;
+  use_sdf = true;
+  return true;
+#else
+  return false;
+#endif
+}
+
+
+unsigned ftlibrary::face_id(const std::filesystem::path& fname)
+{
+  std::lock_guard<std::mutex> guard(face_ids_m);
+  auto [it,inserted] = face_ids.emplace(fname, 1 + face_ids.size());
+  return it->second;
+}
+
+
 
 ftface::ftface(ftlibrary& library_, const std::string& facename)
 : library(library_)
 {
+  std::lock_guard<std::mutex> guard(library.new_face_m);
   auto fname = find_face_path(facename);
   if (! fname.empty()) {
     auto error = FT_New_Face(library.library, fname.c_str(), 0, &face);
     if (! error) {
       use_kerning = FT_HAS_KERNING(face);
+      sk.face = library.face_id(fname);
       return;
     }
   }
@@ -57,12 +97,12 @@ ftface::~ftface()
 std::filesystem::path ftface::find_face_path(const std::string& facename)
 {
   auto pat = FcNameParse((const FcChar8*) facename.c_str());
-  FcConfigSubstitute(library.fcconfig, pat, FcMatchPattern);
+  FcConfigSubstitute(library.fcconfig.get(), pat, FcMatchPattern);
   FcDefaultSubstitute(pat);
 
   std::filesystem::path res;
   FcResult fcres = FcResultNoMatch;
-  if (auto font = FcFontMatch(library.fcconfig, pat, &fcres); font) {
+  if (auto font = FcFontMatch(library.fcconfig.get(), pat, &fcres); font) {
     FcChar8* fname = NULL;
     if (FcPatternGetString(font, FC_FILE, 0, &fname) == FcResultMatch)
       res = (char*) fname;
@@ -74,6 +114,243 @@ std::filesystem::path ftface::find_face_path(const std::string& facename)
 }
 
 
+void ftface::apply_size()
+{
+  if (applied_sk != sk) {
+    FT_Set_Char_Size(face, 0, sk.size, sk.hdpi, sk.vdpi);
+    applied_sk = sk;
+  }
+}
+
+
+std::shared_ptr<const ftglyph> ftface::get_glyph(utf8proc_int32_t ch, bool metrics_only)
+{
+  if (std::shared_ptr<const ftglyph> res; library.glyphs.find(sk, ch, metrics_only, res))
+    return res;
+
+  if (library.use_sdf && ! metrics_only) {
+    auto glyphidx = FT_Get_Char_Index(face, ch);
+    if (auto sg = get_sdf_glyph(glyphidx); sg)
+      return library.glyphs.insert(sk, ch, false, scale_sdf_glyph(glyphidx, *sg));
+  }
+
+  apply_size();
+
+  auto glyphidx = FT_Get_Char_Index(face, ch);
+  if (auto error = FT_Load_Glyph(face, glyphidx, metrics_only ? FT_LOAD_NO_HINTING | FT_LOAD_NO_BITMAP : FT_LOAD_RENDER); error)
+    return library.glyphs.insert_missing(sk, ch, metrics_only);
+
+  auto slot = face->glyph;
+
+  if (metrics_only && slot->format == FT_GLYPH_FORMAT_OUTLINE) {
+    // This is the bounding box of the bitmap the renderer would produce: the control
+    // box of the outline rounded outward to whole pixels.
+    FT_BBox cbox;
+    FT_Outline_Get_CBox(&slot->outline, &cbox);
+    auto xmin = cbox.xMin & -64;
+    auto ymin = cbox.yMin & -64;
+    auto xmax = (cbox.xMax + 63) & -64;
+    auto ymax = (cbox.yMax + 63) & -64;
+
+    ftglyph g{ glyphidx, slot->advance.x, FT_Int(xmin >> 6), FT_Int(ymax >> 6), unsigned((xmax - xmin) >> 6), unsigned((ymax - ymin) >> 6), { } };
+    return library.glyphs.insert(sk, ch, true, std::move(g));
+  }
+
+  if (metrics_only && FT_Render_Glyph(slot, FT_RENDER_MODE_NORMAL) != 0)
+    return library.glyphs.insert_missing(sk, ch, metrics_only);
+  assert(slot->bitmap.pixel_mode == FT_PIXEL_MODE_GRAY);
+  assert(slot->bitmap.num_grays == 256);
+
+  ftglyph g{ glyphidx, slot->advance.x, slot->bitmap_left, slot->bitmap_top, slot->bitmap.width, slot->bitmap.rows, { } };
+  g.bitmap.resize(g.width * g.rows);
+  for (unsigned y = 0; y < g.rows; ++y)
+    std::copy_n(slot->bitmap.buffer + y * slot->bitmap.pitch, g.width, g.bitmap.begin() + y * g.width);
+
+  return library.glyphs.insert(sk, ch, metrics_only, std::move(g));
+}
+
+
+std::shared_ptr<const sdf_glyph> ftface::get_sdf_glyph(FT_UInt index)
+{
+#ifdef HAVE_FT_SDF
+  if (auto res = library.sdfs.find(sk.face, index); res)
+    return res;
+
+  // The field is computed from the unhinted outline at the reference size.  The size
+  // used for normal rendering has to be set again afterwards.
+  FT_Set_Pixel_Sizes(face, 0, sdf_atlas::reference_ppem);
+  applied_sk = { };
+  if (FT_Load_Glyph(face, index, FT_LOAD_NO_HINTING | FT_LOAD_NO_BITMAP) != 0 || FT_Render_Glyph(face->glyph, FT_RENDER_MODE_SDF) != 0)
+    return nullptr;
+
+  auto slot = face->glyph;
+  sdf_glyph g{ slot->bitmap_left, slot->bitmap_top, slot->bitmap.width, slot->bitmap.rows, slot->linearHoriAdvance / 65536.0, { } };
+  g.field.resize(g.width * g.rows);
+  for (unsigned y = 0; y < g.rows; ++y)
+    std::copy_n(slot->bitmap.buffer + y * slot->bitmap.pitch, g.width, g.field.begin() + y * g.width);
+
+  return library.sdfs.insert(sk.face, index, std::move(g));
+#else
+  return nullptr;
+#endif
+}
+
+
+ftglyph ftface::scale_sdf_glyph(FT_UInt index, const sdf_glyph& sg)
+{
+  // Pixels per em of the requested size and the scale factor relative to the field.
+  double ppem = sk.size / 64.0 * (sk.vdpi ?: sk.hdpi) / 72.0;
+  double k = ppem / sdf_atlas::reference_ppem;
+
+  // Bounding box of the field in target pixels, y pointing up.
+  int x0 = int(std::floor(sg.left * k));
+  int x1 = int(std::ceil((sg.left + int(sg.width)) * k));
+  int y1 = int(std::ceil(sg.top * k));
+  int y0 = int(std::floor((sg.top - int(sg.rows)) * k));
+  unsigned width = std::max(0, x1 - x0);
+  unsigned rows = std::max(0, y1 - y0);
+
+  auto sample = [&sg](int c, int r) -> double {
+    if (c < 0 || r < 0 || unsigned(c) >= sg.width || unsigned(r) >= sg.rows)
+      return 0.0;
+    return sg.field[r * sg.width + c];
+  };
+
+  std::vector<uint8_t> bitmap(width * rows);
+  unsigned cmin = width, cmax = 0, rmin = rows, rmax = 0;
+  for (unsigned j = 0; j < rows; ++j)
+    for (unsigned i = 0; i < width; ++i) {
+      // Center of the target pixel in the coordinates of the field, bilinearly interpolated.
+      double fc = (x0 + i + 0.5) / k - sg.left - 0.5;
+      double fr = sg.top - (y1 - j - 0.5) / k - 0.5;
+      int c = int(std::floor(fc));
+      int r = int(std::floor(fr));
+      double ac = fc - c;
+      double ar = fr - r;
+      double v = (1 - ar) * ((1 - ac) * sample(c, r) + ac * sample(c + 1, r)) + ar * ((1 - ac) * sample(c, r + 1) + ac * sample(c + 1, r + 1));
+
+      // Signed distance in target pixels, converted to coverage.
+      double sd = (v - 128.0) / 128.0 * sdf_atlas::spread * k;
+      auto cov = uint8_t(std::clamp(0.5 + sd, 0.0, 1.0) * 255.0 + 0.5);
+      bitmap[j * width + i] = cov;
+      if (cov != 0) {
+        cmin = std::min(cmin, i);
+        cmax = std::max(cmax, i);
+        rmin = std::min(rmin, j);
+        rmax = std::max(rmax, j);
+      }
+    }
+
+  FT_Pos advance = std::lround(sg.advance * k * 64);
+
+  // The field has a margin for the spread.  Only the covered pixels are returned.
+  if (cmin > cmax)
+    return ftglyph{ index, advance, 0, 0, 0, 0, { } };
+  ftglyph res{ index, advance, FT_Int(x0 + cmin), FT_Int(y1 - rmin), cmax - cmin + 1, rmax - rmin + 1, { } };
+  res.bitmap.resize(res.width * res.rows);
+  for (unsigned j = 0; j < res.rows; ++j)
+    std::copy_n(bitmap.begin() + (rmin + j) * width + cmin, res.width, res.bitmap.begin() + j * res.width);
+  return res;
+}
+
+
+FT_Pos ftface::get_kerning(FT_UInt left, FT_UInt right)
+{
+  FT_Pos res;
+  if (! library.glyphs.find_kerning(sk, left, right, res)) {
+    apply_size();
+
+    FT_Vector kern;
+    FT_Get_Kerning(face, left, right, FT_KERNING_DEFAULT, &kern);
+    res = kern.x;
+    library.glyphs.insert_kerning(sk, left, right, res);
+  }
+  return res;
+}
+
+
+bool glyph_cache::find(const size_key& sk, utf8proc_int32_t ch, bool metrics_only, std::shared_ptr<const ftglyph>& res)
+{
+  std::lock_guard<std::mutex> guard(m);
+  auto it = glyphs.find(glyph_key{ sk, ch, metrics_only });
+  if (it == glyphs.end())
+    return false;
+  lru.splice(lru.begin(), lru, it->second);
+  res = it->second->second;
+  return true;
+}
+
+
+std::shared_ptr<const ftglyph> glyph_cache::insert(const size_key& sk, utf8proc_int32_t ch, bool metrics_only, ftglyph&& g)
+{
+  return store(glyph_key{ sk, ch, metrics_only }, std::make_shared<const ftglyph>(std::move(g)));
+}
+
+
+std::shared_ptr<const ftglyph> glyph_cache::insert_missing(const size_key& sk, utf8proc_int32_t ch, bool metrics_only)
+{
+  return store(glyph_key{ sk, ch, metrics_only }, nullptr);
+}
+
+
+std::shared_ptr<const ftglyph> glyph_cache::store(const glyph_key& key, std::shared_ptr<const ftglyph>&& res)
+{
+  std::lock_guard<std::mutex> guard(m);
+  if (auto it = glyphs.find(key); it != glyphs.end()) {
+    // Another thread was faster.
+    lru.splice(lru.begin(), lru, it->second);
+    return it->second->second;
+  }
+
+  lru.emplace_front(key, res);
+  glyphs.emplace(key, lru.begin());
+  if (lru.size() > capacity) {
+    glyphs.erase(lru.back().first);
+    lru.pop_back();
+  }
+
+  return std::move(res);
+}
+
+
+bool glyph_cache::find_kerning(const size_key& sk, FT_UInt left, FT_UInt right, FT_Pos& kern)
+{
+  std::lock_guard<std::mutex> guard(m);
+  auto it = kernings.find(kerning_key{ sk, left, right });
+  if (it == kernings.end())
+    return false;
+  kern = it->second;
+  return true;
+}
+
+
+void glyph_cache::insert_kerning(const size_key& sk, FT_UInt left, FT_UInt right, FT_Pos kern)
+{
+  std::lock_guard<std::mutex> guard(m);
+  // Kerning values are tiny.  Just start over when there are too many.
+  if (kernings.size() >= 4 * capacity)
+    kernings.clear();
+  kernings.emplace(kerning_key{ sk, left, right }, kern);
+}
+
+
+std::shared_ptr<const sdf_glyph> sdf_atlas::find(unsigned face, FT_UInt index)
+{
+  std::lock_guard<std::mutex> guard(m);
+  auto it = glyphs.find({ face, index });
+  return it == glyphs.end() ? nullptr : it->second;
+}
+
+
+std::shared_ptr<const sdf_glyph> sdf_atlas::insert(unsigned face, FT_UInt index, sdf_glyph&& g)
+{
+  auto res = std::make_shared<const sdf_glyph>(std::move(g));
+  std::lock_guard<std::mutex> guard(m);
+  // If another thread was faster use its result.
+  return glyphs.emplace(std::make_pair(face, index), res).first->second;
+}
+
+
 bool convert_string(const std::string& s, std::vector<utf8proc_int32_t>& wbuf)
 {
   wbuf.resize(s.size() + 1);
@@ -1,8 +1,15 @@
 #ifndef _FTLIBRARY_HH
 #define _FTLIBRARY_HH 1
 
+#include <cstdint>
 #include <filesystem>
+#include <future>
+#include <list>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 #include <ft2build.h>
 #include FT_FREETYPE_H
@@ -21,18 +28,130 @@ static_assert(__cpp_variadic_templates >= 200704);
 struct ftlibrary;
 
 
+// Rendered glyph as kept in the glyph cache.  The bitmap uses 256 gray levels.  For
+// glyphs loaded only to determine the metrics the bitmap is empty but the dimensions
+// are those the rendered bitmap would have.
+struct ftglyph {
+  FT_UInt index;
+  FT_Pos advance;
+  FT_Int left;
+  FT_Int top;
+  unsigned width;
+  unsigned rows;
+  std::vector<uint8_t> bitmap;
+};
+
+
+// Bounded cache of rendered glyphs and kerning values.  Glyphs are identified by the
+// face, the character size in 26.6 format as passed to FreeType, the resolution, the
+// code point, and whether the bitmap is needed or only the metrics.  The least recently
+// used glyphs are dropped first.  Glyphs FreeType cannot load are cached as null
+// pointers.  The object is shared by all threads using the library.
+struct glyph_cache {
+  glyph_cache(size_t capacity_) : capacity(capacity_) { }
+
+  struct size_key {
+    unsigned face;
+    FT_F26Dot6 size;
+    FT_UInt hdpi;
+    FT_UInt vdpi;
+
+    bool operator==(const size_key&) const = default;
+  };
+
+  bool find(const size_key& sk, utf8proc_int32_t ch, bool metrics_only, std::shared_ptr<const ftglyph>& res);
+  std::shared_ptr<const ftglyph> insert(const size_key& sk, utf8proc_int32_t ch, bool metrics_only, ftglyph&& g);
+  std::shared_ptr<const ftglyph> insert_missing(const size_key& sk, utf8proc_int32_t ch, bool metrics_only);
+
+  bool find_kerning(const size_key& sk, FT_UInt left, FT_UInt right, FT_Pos& kern);
+  void insert_kerning(const size_key& sk, FT_UInt left, FT_UInt right, FT_Pos kern);
+
+private:
+  struct glyph_key {
+    size_key sk;
+    utf8proc_int32_t ch;
+    bool metrics_only;
+
+    bool operator==(const glyph_key&) const = default;
+  };
+  struct kerning_key {
+    size_key sk;
+    FT_UInt left;
+    FT_UInt right;
+
+    bool operator==(const kerning_key&) const = default;
+  };
+  struct key_hash {
+    static size_t combine(size_t h, size_t v) { return h ^ (v + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2)); }
+    size_t operator()(const size_key& k) const { return combine(combine(combine(k.face, k.size), k.hdpi), k.vdpi); }
+    size_t operator()(const glyph_key& k) const { return combine(combine((*this)(k.sk), k.ch), k.metrics_only); }
+    size_t operator()(const kerning_key& k) const { return combine(combine((*this)(k.sk), k.left), k.right); }
+  };
+
+  const size_t capacity;
+  std::mutex m;
+  using lru_type = std::list<std::pair<glyph_key,std::shared_ptr<const ftglyph>>>;
+  lru_type lru;
+  std::unordered_map<glyph_key,lru_type::iterator,key_hash> glyphs;
+  std::unordered_map<kerning_key,FT_Pos,key_hash> kernings;
+
+  std::shared_ptr<const ftglyph> store(const glyph_key& key, std::shared_ptr<const ftglyph>&& res);
+};
+
+
+// Signed distance fields of glyphs, rasterized once per face at a reference size.  Labels
+// of any size can be rendered from them without rasterizing the outlines again.  The
+// values are those produced by FreeType: 128 is the outline, larger values are inside.
+// Position and advance are in pixels at the reference size.
+struct sdf_glyph {
+  FT_Int left;
+  FT_Int top;
+  unsigned width;
+  unsigned rows;
+  double advance;
+  std::vector<uint8_t> field;
+};
+
+
+struct sdf_atlas {
+  // Size in pixels per em of the fields and the distance in pixels represented by the
+  // range of values.  The time FreeType needs to compute a field grows quickly with the
+  // spread.  Labels are mostly scaled down and a small spread still covers more than a
+  // pixel of the target.
+  static constexpr FT_UInt reference_ppem = 64;
+  static constexpr int spread = 4;
+
+  std::shared_ptr<const sdf_glyph> find(unsigned face, FT_UInt index);
+  std::shared_ptr<const sdf_glyph> insert(unsigned face, FT_UInt index, sdf_glyph&& g);
+
+private:
+  std::mutex m;
+  std::map<std::pair<unsigned,FT_UInt>,std::shared_ptr<const sdf_glyph>> glyphs;
+};
+
+
 struct ftface {
   ftface(ftlibrary& library_, const std::string& facename);
   ~ftface();
 
-  void set_size(double s, unsigned hdpi, unsigned vdpi = 0) { FT_Set_Char_Size(face, 0, FT_UInt(s * 64), hdpi, vdpi); }
+  // The size is only passed on to FreeType when a glyph has to be rendered.
+  void set_size(double s, unsigned hdpi, unsigned vdpi = 0) { sk.size = FT_F26Dot6(s * 64); sk.hdpi = hdpi; sk.vdpi = vdpi; }
+
+  std::shared_ptr<const ftglyph> get_glyph(utf8proc_int32_t ch, bool metrics_only = false);
+  FT_Pos get_kerning(FT_UInt left, FT_UInt right);
 
 private:
   FT_Face face;
   bool use_kerning;
   ftlibrary& library;
 
+  glyph_cache::size_key sk{ };
+  glyph_cache::size_key applied_sk{ };
+
   std::filesystem::path find_face_path(const std::string& facename);
+  void apply_size();
+  std::shared_ptr<const sdf_glyph> get_sdf_glyph(FT_UInt index);
+  ftglyph scale_sdf_glyph(FT_UInt index, const sdf_glyph& sg);
 
   template<typename T>
   friend struct font_render;
@@ -40,18 +159,38 @@ private:
 
 
 struct ftlibrary {
+  static constexpr size_t default_glyph_cache_size = 2048;
 
-  ftlibrary();
+  ftlibrary(size_t glyph_cache_size = default_glyph_cache_size);
   ~ftlibrary();
 
   ftface& find_font(const std::string& fontface);
 
+  // Render glyph bitmaps from signed distance fields instead of the outlines.  Returns
+  // false if the FreeType library does not support this.
+  bool enable_sdf();
+
 private:
   FT_Library library;
-  FcConfig* fcconfig;
+  // Loading the fontconfig configuration scans the font directories.  This happens in the
+  // background until the first face is needed.
+  std::shared_future<FcConfig*> fcconfig;
+
+  // Faces can be created by several threads.  The FreeType library object and the
+  // fontconfig configuration must not be used concurrently for that.
+  std::mutex new_face_m;
 
   std::map<std::string,ftface> faces;
 
+  std::mutex face_ids_m;
+  std::map<std::filesystem::path,unsigned> face_ids;
+  unsigned face_id(const std::filesystem::path& fname);
+
+  glyph_cache glyphs;
+
+  bool use_sdf = false;
+  sdf_atlas sdfs;
+
   friend struct ftface;
 };
 
@@ -61,18 +200,21 @@ struct font_render {
   using render_type = T;
 
   template<typename... Args>
-  font_render(ftface& fontface_, Args... args);
+  font_render(ftface& fontface_, Args&&... args);
 
   template<typename... Args>
-  Magick::Image draw(const std::string& s, Args... args);
+  decltype(auto) draw(const std::string& s, Args&&... args);
   template<typename... Args>
-  Magick::Image draw(const std::vector<std::string>& vs, Args... args);
+  decltype(auto) draw(const std::vector<std::string>& vs, Args&&... args);
 private:
-  void call_render(double fontsize, FT_UInt dpi, const std::vector<utf8proc_int32_t>& wch);
-  void call_render(double fontsize, FT_UInt dpi, const std::vector<std::vector<utf8proc_int32_t>>& wch);
+  void render_line(const std::vector<utf8proc_int32_t>& wch, bool metrics_only);
+  void call_render(double fontsize, FT_UInt dpi, const std::vector<utf8proc_int32_t>& wch, bool metrics_only = false);
+  void call_render(double fontsize, FT_UInt dpi, const std::vector<std::vector<utf8proc_int32_t>>& wch, bool metrics_only = false);
 
   template<typename Strings, typename... Args>
-  Magick::Image draw2(const Strings& vs, Args... args);
+  decltype(auto) draw2(const Strings& vs, Args&&... args);
+
+  static constexpr FT_UInt measure_scale = 10;
 
   ftface& fontface;
   render_type renderer;
@@ -81,77 +223,58 @@ private:
 
 template<typename T>
 template<typename... Args>
-font_render<T>::font_render(ftface& fontface_, Args... args)
-: fontface(fontface_), renderer(args...)
+font_render<T>::font_render(ftface& fontface_, Args&&... args)
+: fontface(fontface_), renderer(std::forward<Args>(args)...)
 {
 }
 
 
 template<typename T>
-void font_render<T>::call_render(double fontsize, FT_UInt dpi, const std::vector<utf8proc_int32_t>& wbuf)
+void font_render<T>::render_line(const std::vector<utf8proc_int32_t>& wbuf, bool metrics_only)
 {
-  fontface.set_size(fontsize, dpi);
-
-  renderer.reset();
-
-  FT_Vector pen{ 0, 0 };
+  FT_Pos penx = 0;
   FT_UInt prevglyphidx = 0;
 
   renderer.start();
 
   for (auto wch : wbuf) {
-    auto glyphidx = FT_Get_Char_Index(fontface.face, wch);
-
-    if (fontface.use_kerning && prevglyphidx != 0 && glyphidx != 0) {
-      FT_Vector kern;
-      FT_Get_Kerning(fontface.face, prevglyphidx, glyphidx, FT_KERNING_DEFAULT, &kern);
-      pen.x += kern.x;
-    }
-
-    if (auto error = FT_Load_Glyph(fontface.face, glyphidx, FT_LOAD_RENDER); error)
+    auto glyph = fontface.get_glyph(wch, metrics_only);
+    if (! glyph)
       continue;
 
-    renderer(fontface.face->glyph, (pen.x + 0x20) >> 6);
+    if (fontface.use_kerning && prevglyphidx != 0 && glyph->index != 0)
+      penx += fontface.get_kerning(prevglyphidx, glyph->index);
 
-    pen.x += fontface.face->glyph->advance.x;
-    prevglyphidx = glyphidx;
-  }
+    renderer(*glyph, (penx + 0x20) >> 6);
 
-  renderer.compute_dimensions();
+    penx += glyph->advance;
+    prevglyphidx = glyph->index;
+  }
 }
 
 
 template<typename T>
-void font_render<T>::call_render(double fontsize, FT_UInt dpi, const std::vector<std::vector<utf8proc_int32_t>>& wbufs)
+void font_render<T>::call_render(double fontsize, FT_UInt dpi, const std::vector<utf8proc_int32_t>& wbuf, bool metrics_only)
 {
   fontface.set_size(fontsize, dpi);
 
   renderer.reset();
 
-  for (const auto& wbuf : wbufs) {
-    FT_Vector pen{ 0, 0 };
-    FT_UInt prevglyphidx = 0;
-
-    renderer.start();
+  render_line(wbuf, metrics_only);
 
-    for (auto wch : wbuf) {
-      auto glyphidx = FT_Get_Char_Index(fontface.face, wch);
+  renderer.compute_dimensions();
+}
 
-      if (fontface.use_kerning && prevglyphidx != 0 && glyphidx != 0) {
-        FT_Vector kern;
-        FT_Get_Kerning(fontface.face, prevglyphidx, glyphidx, FT_KERNING_DEFAULT, &kern);
-        pen.x += kern.x;
-      }
 
-      if (auto error = FT_Load_Glyph(fontface.face, glyphidx, FT_LOAD_RENDER); error)
-        continue;
+template<typename T>
+void font_render<T>::call_render(double fontsize, FT_UInt dpi, const std::vector<std::vector<utf8proc_int32_t>>& wbufs, bool metrics_only)
+{
+  fontface.set_size(fontsize, dpi);
 
-      renderer(fontface.face->glyph, (pen.x + 0x20) >> 6);
+  renderer.reset();
 
-      pen.x += fontface.face->glyph->advance.x;
-      prevglyphidx = glyphidx;
-    }
-  }
+  for (const auto& wbuf : wbufs)
+    render_line(wbuf, metrics_only);
 
   renderer.compute_dimensions();
 }
@@ -162,18 +285,21 @@ bool convert_string(const std::string& s, std::vector<utf8proc_int32_t>& wbuf);
 
 template<typename T>
 template<typename Strings, typename... Args>
-Magick::Image font_render<T>::draw2(const Strings& wbuf, Args... args)
+decltype(auto) font_render<T>::draw2(const Strings& wbuf, Args&&... args)
 {
+  // The text dimensions are determined once from the glyph metrics alone, at a higher
+  // resolution for precision.  They scale linearly with the font size which therefore
+  // can be computed directly.  Only if rounding to whole pixels makes the rendered text
+  // too large is the text rasterized more than once.
   auto [fontsize, dpi] = renderer.first_font_size();
+  call_render(fontsize, measure_scale * dpi, wbuf, true);
+  fontsize = renderer.fit_font_size(measure_scale);
   while (true) {
     call_render(fontsize, dpi, wbuf);
 
     auto [finished, new_fontsize] = renderer.check_size();
-    if (finished) {
-      if (fontsize != new_fontsize)
-        call_render(new_fontsize, dpi, wbuf);
+    if (finished)
       break;
-    }
     fontsize = new_fontsize;
   }
 
@@ -183,9 +309,10 @@ Magick::Image font_render<T>::draw2(const Strings& wbuf, Args... args)
 
 template<typename T>
 template<typename... Args>
-Magick::Image font_render<T>::draw(const std::string& s, Args... args)
+decltype(auto) font_render<T>::draw(const std::string& s, Args&&... args)
 {
-  std::vector<utf8proc_int32_t> wbuf;
+  // The conversion buffers are reused so that rendering a label does not allocate memory.
+  thread_local std::vector<utf8proc_int32_t> wbuf;
   if (! convert_string(s, wbuf))
     throw std::runtime_error("invalid character");
 
@@ -195,15 +322,14 @@ Magick::Image font_render<T>::draw(const std::string& s, Args... args)
 
 template<typename T>
 template<typename... Args>
-Magick::Image font_render<T>::draw(const std::vector<std::string>& vs, Args... args)
+decltype(auto) font_render<T>::draw(const std::vector<std::string>& vs, Args&&... args)
 {
-  std::vector<std::vector<utf8proc_int32_t>> vwbuf;
+  thread_local std::vector<std::vector<utf8proc_int32_t>> vwbuf;
 
-  for (auto s : vs) {
-    auto& wbuf = vwbuf.emplace_back();
-    if (! convert_string(s, wbuf))
+  vwbuf.resize(vs.size());
+  for (size_t i = 0; i < vs.size(); ++i)
+    if (! convert_string(vs[i], vwbuf[i]))
       throw std::runtime_error("invalid character");
-  }
 
   return draw2(vwbuf, std::forward<Args>(args)...);
 }
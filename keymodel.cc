@@ -0,0 +1,182 @@
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <string_view>
+
+#include <unistd.h>
+
+#include "keymodel.hh"
+
+
+namespace {
+
+  std::atomic<uint64_t> nwrites;
+  std::atomic<uint64_t> nsuppressed;
+  std::atomic<uint64_t> nsuperseded;
+
+
+  struct pending {
+    key_model* model;
+    unsigned page;
+    unsigned key;
+    key_model::content c;
+    int handle;
+    bool has_buffer;
+    rgba_buffer buffer;
+  };
+
+  // Writes recorded by the frames of the thread.  Only the first FRAME_USED elements are
+  // current; the others are kept so that the memory of their buffers is reused.
+  thread_local unsigned frame_depth;
+  thread_local std::vector<pending> frame_writes;
+  thread_local size_t frame_used;
+
+
+  key_model::content buffer_content(const rgba_buffer& buffer)
+  {
+    std::string_view bytes(reinterpret_cast<const char*>(buffer.pixels.data()), buffer.pixels.size());
+    return { false, std::hash<std::string_view>()(bytes) ^ (uint64_t(buffer.width) << 32 | buffer.height) };
+  }
+
+
+  bool record(key_model* model, unsigned page, unsigned key, const key_model::content& c, int handle, const rgba_buffer* buffer)
+  {
+    if (frame_depth == 0)
+      return false;
+
+    auto end = frame_writes.begin() + frame_used;
+    auto it = std::find_if(frame_writes.begin(), end, [model, key](const auto& p){ return p.model == model && p.key == key; });
+    if (it != end)
+      ++nsuperseded;
+    else {
+      if (frame_used == frame_writes.size())
+        frame_writes.emplace_back();
+      it = frame_writes.begin() + frame_used++;
+      it->model = model;
+      it->key = key;
+    }
+    it->page = page;
+    it->c = c;
+    it->handle = handle;
+    it->has_buffer = buffer != nullptr;
+    if (buffer != nullptr) {
+      // The assignment reuses the memory of the slot.
+      it->buffer.width = buffer->width;
+      it->buffer.height = buffer->height;
+      it->buffer.pixels.assign(buffer->pixels.begin(), buffer->pixels.end());
+    }
+    return true;
+  }
+
+} // anonymous namespace
+
+
+key_model::key_model(streamdeck::device_type& dev_)
+: dev(dev_), shown(dev.key_count)
+{
+}
+
+
+void key_model::set(unsigned page_, unsigned key, int handle)
+{
+  content c{ true, uint64_t(handle) };
+  if (! record(this, page_, key, c, handle, nullptr))
+    apply(page_, key, c, handle, nullptr);
+}
+
+
+void key_model::set(unsigned page_, unsigned key, const rgba_buffer& buffer)
+{
+  auto c = buffer_content(buffer);
+  if (! record(this, page_, key, c, -1, &buffer))
+    apply(page_, key, c, -1, &buffer);
+}
+
+
+void key_model::show_page(unsigned page_)
+{
+  std::lock_guard<std::mutex> guard(m);
+  page = page_;
+}
+
+
+void key_model::apply(unsigned page_, unsigned key, const content& c, int handle, const rgba_buffer* buffer)
+{
+  std::lock_guard<std::mutex> guard(m);
+  if (page_ != page)
+    return;
+  if (shown[key] == c) {
+    ++nsuppressed;
+    return;
+  }
+
+  if (buffer != nullptr)
+    dev.set_key_image(key / dev.key_cols, key % dev.key_cols, buffer->image());
+  else
+    dev.set_key_image(key, handle);
+  shown[key] = c;
+  ++nwrites;
+}
+
+
+key_model::counters key_model::stats()
+{
+  return { nwrites.load(), nsuppressed.load(), nsuperseded.load() };
+}
+
+
+void key_model::report(int fd)
+{
+  char buf[128];
+  char* p = buf;
+  auto add = [&p](const char* s){ while (*s != '\0') *p++ = *s++; };
+  auto add_number = [&p](uint64_t n){
+    char digits[20];
+    int i = 0;
+    do
+      digits[i++] = '0' + n % 10;
+    while ((n /= 10) != 0);
+    while (i > 0)
+      *p++ = digits[--i];
+  };
+
+  add("key writes: ");
+  add_number(nwrites.load());
+  add(", suppressed: ");
+  add_number(nsuppressed.load());
+  add(", superseded: ");
+  add_number(nsuperseded.load());
+  add("\n");
+  auto _ = write(fd, buf, p - buf);
+  (void) _;
+}
+
+
+key_frame::key_frame()
+{
+  ++frame_depth;
+}
+
+
+key_frame::~key_frame()
+{
+  if (--frame_depth == 0)
+    flush();
+}
+
+
+void key_frame::flush()
+{
+  auto end = frame_writes.begin() + frame_used;
+  std::sort(frame_writes.begin(), end, [](const pending& l, const pending& r){ return l.key < r.key; });
+  for (auto it = frame_writes.begin(); it != end; ++it)
+    try {
+      it->model->apply(it->page, it->key, it->c, it->handle, it->has_buffer ? &it->buffer : nullptr);
+    }
+    catch (const std::exception& e) {
+      std::cerr << "cannot update key " << it->key << ": " << e.what() << std::endl;
+    }
+  frame_used = 0;
+}
@@ -0,0 +1,75 @@
+#ifndef _KEYMODEL_HH
+#define _KEYMODEL_HH 1
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include <streamdeckpp.hh>
+
+#include "buttontext.hh"
+
+
+// Retained model of what the keys of a device show.  The content of a key is identified
+// by the handle of a registered image or by a hash of the pixels of a buffer.  Writes of
+// the content a key already shows are suppressed.  Every write is meant for a page, by
+// default the one shown when the write is made.  Writes which reach the device after
+// another page is shown are dropped.
+struct key_model {
+  key_model(streamdeck::device_type& dev_);
+
+  streamdeck::device_type& device() { return dev; }
+
+  void set(unsigned key, int handle) { set(page, key, handle); }
+  void set(unsigned key, const rgba_buffer& buffer) { set(page, key, buffer); }
+  void set(unsigned page_, unsigned key, int handle);
+  void set(unsigned page_, unsigned key, const rgba_buffer& buffer);
+
+  void show_page(unsigned page_);
+
+  struct content {
+    bool is_handle;
+    uint64_t value;
+
+    bool operator==(const content&) const = default;
+  };
+
+  struct counters {
+    uint64_t writes;
+    uint64_t suppressed;
+    uint64_t superseded;
+  };
+  static counters stats();
+  // Write the counters to FD.  Only async-signal-safe functions are used.
+  static void report(int fd);
+
+private:
+  void apply(unsigned page_, unsigned key, const content& c, int handle, const rgba_buffer* buffer);
+
+  streamdeck::device_type& dev;
+  std::atomic<unsigned> page = 0;
+  std::mutex m;
+  std::vector<std::optional<content>> shown;
+
+  friend struct key_frame;
+};
+
+
+// While an object of this type exists the writes of the thread to key models are only
+// recorded.  When the outermost frame ends the model is reconciled: every key changed in
+// the frame is compared once with what it shows and written in key order if necessary.
+struct key_frame {
+  key_frame();
+  ~key_frame();
+
+  // Reconcile the writes recorded so far by the thread without ending the frames.  Used
+  // before the thread waits for a longer time.
+  static void flush();
+
+  key_frame(const key_frame&) = delete;
+  key_frame& operator=(const key_frame&) = delete;
+};
+
+#endif // keymodel.hh
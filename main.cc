@@ -1,8 +1,19 @@
+#include <algorithm>
+#include <atomic>
 #include <cerrno>
+#include <charconv>
 #include <cstdlib>
 #include <filesystem>
+#include <functional>
+#include <future>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <regex>
+#include <string_view>
+#include <thread>
+#include <vector>
 
 #include <error.h>
 #include <pwd.h>
@@ -24,8 +35,11 @@ extern "C" {
 #include <X11/extensions/scrnsaver.h>
 #include <X11/extensions/XInput2.h>
 
+#include "animation.hh"
+#include "keymodel.hh"
 #include "obs.hh"
 #include "ftlibrary.hh"
+#include "startup.hh"
 extern "C" {
 #include "resources.h"
 }
@@ -62,29 +76,198 @@ namespace {
     return std::filesystem::current_path();
   }
 
-} // anonymous namespace
 
+  // The built-in icons are stored as uncompressed PAM files with 8-bit RGBA tuples.  The
+  // pixels can be used directly, only the header has to be parsed.  Anything else is left
+  // to ImageMagick.
+  std::optional<Magick::Image> read_rgba_pam(std::string_view data)
+  {
+    unsigned width = 0;
+    unsigned height = 0;
+    bool rgba = false;
 
+    if (! data.starts_with("P7\n"))
+      return std::nullopt;
+    data.remove_prefix(3);
+    while (true) {
+      auto eol = data.find('\n');
+      if (eol == std::string_view::npos)
+        return std::nullopt;
+      auto line = data.substr(0, eol);
+      data.remove_prefix(eol + 1);
 
-Magick::Image find_image(const std::filesystem::path& path)
-{
-  if (! path.is_relative())
-    return Magick::Image(path);
-
-  try {
-    auto data = Gio::Resource::lookup_data_global(resource_ns / path);
-    gsize size;
-    auto ptr = static_cast<const char*>(data->get_data(size));
-    return Magick::Image(Magick::Blob(ptr, size));
+      if (line == "ENDHDR")
+        break;
+      if (line.starts_with('#'))
+        continue;
+      auto sp = line.find(' ');
+      if (sp == std::string_view::npos)
+        return std::nullopt;
+      auto name = line.substr(0, sp);
+      auto value = line.substr(sp + 1);
+      if (name == "WIDTH")
+        std::from_chars(value.data(), value.data() + value.size(), width);
+      else if (name == "HEIGHT")
+        std::from_chars(value.data(), value.data() + value.size(), height);
+      else if (name == "TUPLTYPE")
+        rgba = value == "RGB_ALPHA";
+      else if ((name == "DEPTH" && value != "4") || (name == "MAXVAL" && value != "255"))
+        return std::nullopt;
+    }
+
+    if (! rgba || width == 0 || height == 0 || data.size() < size_t(width) * height * 4)
+      return std::nullopt;
+    return Magick::Image(width, height, "RGBA", Magick::CharPixel, data.data());
   }
-  catch (Glib::Error&) {
+
+
+  // Fast path for the built-in icons, no PNG decoding.
+  std::optional<Magick::Image> load_builtin_image(const std::filesystem::path& path)
+  {
+    if (! path.is_relative() || path.extension() != ".png")
+      return std::nullopt;
+
+    try {
+      auto data = Gio::Resource::lookup_data_global(resource_ns / std::filesystem::path(path).replace_extension(".pam"));
+      gsize size;
+      auto ptr = static_cast<const char*>(data->get_data(size));
+      if (auto image = read_rgba_pam(std::string_view(ptr, size)); image)
+        return image;
+      return Magick::Image(Magick::Blob(ptr, size));
+    }
+    catch (Glib::Error&) {
+    }
+    return std::nullopt;
   }
-  try {
-    return Magick::Image(get_homedir() / "Pictures" / path);
+
+
+  // Look for PATH in the resources, the user's pictures, and the system pixmaps, in this
+  // order.  READ is called with either a blob or a file name.
+  template<typename Read>
+  auto read_image_file(const std::filesystem::path& path, Read read)
+  {
+    if (! path.is_relative())
+      return read(path.native());
+
+    try {
+      auto data = Gio::Resource::lookup_data_global(resource_ns / path);
+      gsize size;
+      auto ptr = static_cast<const char*>(data->get_data(size));
+      return read(Magick::Blob(ptr, size));
+    }
+    catch (Glib::Error&) {
+    }
+    try {
+      return read((get_homedir() / "Pictures" / path).native());
+    }
+    catch (Magick::ErrorBlob&) {
+    }
+    return read((std::filesystem::path("/usr/share/pixmaps") / path).native());
+  }
+
+
+  Magick::Image load_image(const std::filesystem::path& path)
+  {
+    startup::scope timing("load image", path.native());
+
+    if (auto image = load_builtin_image(path); image)
+      return *image;
+
+    return read_image_file(path, [](const auto& src){ return Magick::Image(src); });
   }
-  catch (Magick::ErrorBlob&) {
+
+
+  // All frames of an animated image, each composited with the frames before it so that it
+  // can be shown on its own.  Other images result in a single frame.
+  std::vector<Magick::Image> load_frames(const std::filesystem::path& path)
+  {
+    startup::scope timing("load frames", path.native());
+
+    if (auto image = load_builtin_image(path); image)
+      return { std::move(*image) };
+
+    auto frames = read_image_file(path, [](const auto& src){
+      std::vector<Magick::Image> res;
+      Magick::readImages(&res, src);
+      return res;
+    });
+    if (frames.size() <= 1)
+      return frames;
+
+    std::vector<Magick::Image> res;
+    Magick::coalesceImages(&res, frames.begin(), frames.end());
+    return res;
   }
-  return Magick::Image(std::filesystem::path("/usr/share/pixmaps") / path);
+
+
+  // Decoded images by the path they were requested with.  Magick::Image objects share the
+  // pixels until they are modified, handing out copies is cheap.  Different images can be
+  // decoded concurrently, a thread requesting an image which is being decoded waits.
+  // Failed loads are not remembered.  The frames of animated images are kept separately.
+  std::mutex images_m;
+  std::map<std::filesystem::path,std::shared_future<Magick::Image>> images;
+  std::map<std::filesystem::path,std::shared_future<std::vector<Magick::Image>>> animations;
+
+
+  template<typename T, typename Load>
+  T find_cached(std::map<std::filesystem::path,std::shared_future<T>>& cache, const std::filesystem::path& path, Load load)
+  {
+    std::unique_lock<std::mutex> lock(images_m);
+    if (auto it = cache.find(path); it != cache.end()) {
+      auto res = it->second;
+      lock.unlock();
+      return res.get();
+    }
+
+    std::promise<T> promise;
+    cache.emplace(path, promise.get_future().share());
+    lock.unlock();
+
+    try {
+      auto res = load(path);
+      promise.set_value(res);
+      return res;
+    }
+    catch (...) {
+      // Threads already waiting get the error, the next request tries again.
+      promise.set_exception(std::current_exception());
+      lock.lock();
+      cache.erase(path);
+      throw;
+    }
+  }
+
+
+  // Images registered with the devices, identified by the signature of the pixels.  The
+  // same icon used for many keys is uploaded only once.
+  std::mutex registered_m;
+  std::map<std::pair<const streamdeck::device_type*,std::string>,int> registered;
+
+
+  int register_image(streamdeck::device_type& dev, Magick::Image&& image)
+  {
+    // The signature is computed from all pixels, do not hold the lock meanwhile.
+    auto key = std::make_pair(&dev, image.signature());
+    std::lock_guard<std::mutex> guard(registered_m);
+    auto it = registered.find(key);
+    if (it == registered.end())
+      it = registered.emplace(std::move(key), dev.register_image(std::move(image))).first;
+    return it->second;
+  }
+
+} // anonymous namespace
+
+
+
+Magick::Image find_image(const std::filesystem::path& path)
+{
+  return find_cached(images, path, load_image);
+}
+
+
+std::vector<Magick::Image> find_frames(const std::filesystem::path& path)
+{
+  return find_cached(animations, path, load_frames);
 }
 
 
@@ -94,7 +277,7 @@ namespace {
 
 
   struct action {
-    action(unsigned k, const libconfig::Setting& setting, streamdeck::device_type& dev_, const char* default_icon = nullptr) : key(k), dev(dev_)
+    action(unsigned k, const libconfig::Setting& setting, key_model& keys_, const char* default_icon = nullptr) : key(k), keys(keys_)
     {
       std::string iconname;
       if (! setting.lookupValue("icon", iconname)) {
@@ -102,69 +285,124 @@ namespace {
           return;
         iconname = default_icon;
       }
-      icon1 = dev.register_image(find_image(iconname));
+      icon1 = register_image(keys.device(), find_image(iconname));
     }
+    action(unsigned k, key_model& keys_) : key(k), keys(keys_), icon1(-1) { }
     virtual ~action() { }
 
     virtual void call() = 0;
 
     virtual void show_icon()
     {
-      dev.set_key_image(key, icon1);
+      keys.set(key, icon1);
     }
 
   protected:
     unsigned key;
-    streamdeck::device_type& dev;
+    key_model& keys;
     int icon1;
   };
 
 
+  // Keylights are found with a search on the network which takes seconds if none answers.
+  // It runs in the background.  Until it is finished the keys controlling keylights show a
+  // placeholder and ignore presses.
+  struct keylight_discovery {
+    ~keylight_discovery()
+    {
+      if (worker.joinable())
+        worker.join();
+    }
+
+    // DONE is called on the discovery thread.
+    void start(std::function<void()> done);
+    bool started() const { return worker.joinable(); }
+    bool available() const { return ready && devices.begin() != devices.end(); }
+
+    // Only to be used when available.
+    keylightpp::device_list_type devices;
+    int placeholder = -1;
+
+  private:
+    std::atomic<bool> ready = false;
+    std::thread worker;
+  };
+
+
+  void keylight_discovery::start(std::function<void()> done)
+  {
+    worker = std::thread([this,done = std::move(done)]{
+      {
+        startup::scope timing("keylight discovery");
+        for (unsigned t = 0; t < 3; ++t) {
+          devices = keylightpp::discover();
+          if (devices.begin() != devices.end())
+            break;
+          sleep(1);
+        }
+      }
+      ready = true;
+      done();
+    });
+  }
+
+
   struct keylight_toggle final : public action {
     using base_type = action;
 
-    keylight_toggle(unsigned k, const libconfig::Setting& setting, streamdeck::device_type& dev_, bool has_serial, std::string& serial_, keylightpp::device_list_type& keylights_)
-    : base_type(k, setting, dev_), serial(has_serial ? serial_ : ""), keylights(keylights_)
+    keylight_toggle(unsigned k, const libconfig::Setting& setting, key_model& keys_, bool has_serial, std::string& serial_, keylight_discovery& keylights_)
+    : base_type(k, setting, keys_), serial(has_serial ? serial_ : ""), keylights(keylights_)
     {
-      nkeylights = 0;
-      for (auto& d : keylights)
-        if (serial.empty() || serial == d.serial)
-          ++nkeylights;
-
       std::string icon1name;
       if (! setting.lookupValue("icon_on", icon1name))
         icon1name = "bulb_on.png";
-      icon1 = dev.register_image(find_image(icon1name));
+      icon1 = register_image(keys.device(), find_image(icon1name));
 
-      if (nkeylights == 1) {
-        std::string icon2name;
-        if (! setting.lookupValue("icon_off", icon2name))
-          icon2name = "bulb_off.png";
-        icon2 = dev.register_image(find_image(icon2name));
-      } else
-        icon2 = icon1;
+      // Whether the second icon is used is only known after the discovery.
+      std::string icon2name;
+      if (! setting.lookupValue("icon_off", icon2name))
+        icon2name = "bulb_off.png";
+      icon2 = register_image(keys.device(), find_image(icon2name));
     }
 
     void call() override
     {
+      if (! keylights.available())
+        return;
+
       bool any = false;
-      for (auto& d : keylights)
+      for (auto& d : keylights.devices)
         if (serial.empty() || serial == d.serial) {
           d.toggle();
           any = true;
         }
-      if (any && nkeylights == 1)
+      if (any && count() == 1)
         show_icon();
     }
 
     void show_icon() override
     {
-      dev.set_key_image(key, nkeylights > 1 || ! keylights.front().state() ? icon1 : icon2);
+      if (! keylights.available())
+        keys.set(key, keylights.placeholder);
+      else if (count() != 1)
+        keys.set(key, icon1);
+      else
+        for (auto& d : keylights.devices)
+          if (serial.empty() || serial == d.serial)
+            keys.set(key, d.state() ? icon2 : icon1);
     }
   private:
+    unsigned count() const
+    {
+      unsigned n = 0;
+      for (auto& d : keylights.devices)
+        if (serial.empty() || serial == d.serial)
+          ++n;
+      return n;
+    }
+
     const std::string serial;
-    keylightpp::device_list_type& keylights;
-    unsigned nkeylights;
+    keylight_discovery& keylights;
     int icon2;
   };
 
@@ -172,13 +410,15 @@ namespace {
   struct keylight_color final : public action {
     using base_type = action;
 
-    keylight_color(unsigned k, const libconfig::Setting& setting, streamdeck::device_type& dev_, bool has_serial, std::string& serial_, keylightpp::device_list_type& keylights_, int inc_)
-    : base_type(k, setting, dev_, inc_ >= 0 ? "color+.png" : "color-.png"), serial(has_serial ? serial_ : ""), keylights(keylights_), inc(inc_)
+    keylight_color(unsigned k, const libconfig::Setting& setting, key_model& keys_, bool has_serial, std::string& serial_, keylight_discovery& keylights_, int inc_)
+    : base_type(k, setting, keys_, inc_ >= 0 ? "color+.png" : "color-.png"), serial(has_serial ? serial_ : ""), keylights(keylights_), inc(inc_)
     {
     }
 
     void call() override {
-      for (auto& d : keylights)
+      if (! keylights.available())
+        return;
+      for (auto& d : keylights.devices)
         if (serial.empty() || serial == d.serial) {
           if (inc < 0)
             d.color_dec(unsigned(-inc));
@@ -186,9 +426,14 @@ namespace {
             d.color_inc(unsigned(inc));
         }
     }
+
+    void show_icon() override
+    {
+      keys.set(key, keylights.available() ? icon1 : keylights.placeholder);
+    }
   private:
     const std::string serial;
-    keylightpp::device_list_type& keylights;
+    keylight_discovery& keylights;
     const int inc;
   };
 
@@ -196,13 +441,15 @@ namespace {
   struct keylight_brightness final : public action {
     using base_type = action;
 
-    keylight_brightness(unsigned k, const libconfig::Setting& setting, streamdeck::device_type& dev_, bool has_serial, std::string& serial_, keylightpp::device_list_type& keylights_, int inc_)
-    : base_type(k, setting, dev_, inc_ >= 0 ? "brightness+.png" : "brightness-.png"), serial(has_serial ? serial_ : ""), keylights(keylights_), inc(inc_)
+    keylight_brightness(unsigned k, const libconfig::Setting& setting, key_model& keys_, bool has_serial, std::string& serial_, keylight_discovery& keylights_, int inc_)
+    : base_type(k, setting, keys_, inc_ >= 0 ? "brightness+.png" : "brightness-.png"), serial(has_serial ? serial_ : ""), keylights(keylights_), inc(inc_)
     {
     }
 
     void call() override {
-      for (auto& d : keylights)
+      if (! keylights.available())
+        return;
+      for (auto& d : keylights.devices)
         if (serial.empty() || serial == d.serial) {
           if (inc < 0)
             d.brightness_dec(unsigned(-inc));
@@ -210,9 +457,14 @@ namespace {
             d.brightness_inc(unsigned(inc));
         }
     }
+
+    void show_icon() override
+    {
+      keys.set(key, keylights.available() ? icon1 : keylights.placeholder);
+    }
   private:
     const std::string serial;
-    keylightpp::device_list_type& keylights;
+    keylight_discovery& keylights;
     const int inc;
   };
 
@@ -220,7 +472,7 @@ namespace {
   struct execute final : public action {
     using base_type = action;
 
-    execute(unsigned k, const libconfig::Setting& setting, streamdeck::device_type& dev_, std::string&& command_) : base_type(k, setting, dev_), command(std::move(command_)) { }
+    execute(unsigned k, const libconfig::Setting& setting, key_model& keys_, std::string&& command_) : base_type(k, setting, keys_), command(std::move(command_)) { }
 
     void call() override {
       auto _ = system(command.c_str());
@@ -235,8 +487,8 @@ namespace {
   struct keypress final : public action {
     using base_type = action;
 
-    keypress(unsigned k, const libconfig::Setting& setting, streamdeck::device_type& dev_, std::string&& sequence, xdo_t* xdo_) : base_type(k, setting, dev_), sequence_list(1, std::move(sequence)), xdo(xdo_) { }
-    keypress(unsigned k, const libconfig::Setting& setting, streamdeck::device_type& dev_, std::list<std::string>&& sequence_list_, xdo_t* xdo_) : base_type(k, setting, dev_), sequence_list(std::move(sequence_list_)), xdo(xdo_) { }
+    keypress(unsigned k, const libconfig::Setting& setting, key_model& keys_, std::string&& sequence, xdo_t* xdo_) : base_type(k, setting, keys_), sequence_list(1, std::move(sequence)), xdo(xdo_) { }
+    keypress(unsigned k, const libconfig::Setting& setting, key_model& keys_, std::list<std::string>&& sequence_list_, xdo_t* xdo_) : base_type(k, setting, keys_), sequence_list(std::move(sequence_list_)), xdo(xdo_) { }
 
     void call() override {
       for (const auto& sequence : sequence_list)
@@ -251,14 +503,14 @@ namespace {
   struct obsaction final : public action {
     using base_type = action;
 
-    obsaction(unsigned k, const libconfig::Setting& setting, streamdeck::device_type& dev_, obs::button* b_) : base_type(k, setting, dev_), b(b_) { }
+    obsaction(unsigned k, const libconfig::Setting& setting, key_model& keys_, obs::button* b_) : base_type(k, setting, keys_), b(b_) { }
 
     void call() override {
       b->call();
     }
 
     void show_icon() override {
-      b->show_icon();
+      b->request_icon();
     }
 
   private:
@@ -269,9 +521,9 @@ namespace {
   struct tasmota final : public action {
     using base_type = action;
 
-    tasmota(unsigned k, const libconfig::Setting& setting, streamdeck::device_type& dev_, std::string&& device_, std::string&& icon_off, std::string&& icon_on): base_type(k, setting, dev_), device(std::move(device_)) {
-      icon1 = dev.register_image(find_image(icon_off));
-      icon2 = dev.register_image(find_image(icon_on));
+    tasmota(unsigned k, const libconfig::Setting& setting, key_model& keys_, std::string&& device_, std::string&& icon_off, std::string&& icon_on): base_type(k, setting, keys_), device(std::move(device_)) {
+      icon1 = register_image(keys.device(), find_image(icon_off));
+      icon2 = register_image(keys.device(), find_image(icon_on));
       send("Power");
     }
 
@@ -282,7 +534,7 @@ namespace {
 
     void show_icon() override
     {
-      dev.set_key_image(key, is_on ? icon2 : icon1);
+      keys.set(key, is_on ? icon2 : icon1);
     }
 
   private:
@@ -378,8 +630,8 @@ namespace {
       right,
     };
 
-    pageaction(unsigned k, const libconfig::Setting& setting, streamdeck::device_type& dev_, unsigned to_page_, direction dir, deck_config& deck_)
-    : base_type(k, setting, dev_, dir == direction::left ? "left-arrow.png" : "right-arrow.png"), to_page(to_page_), deck(deck_) {}
+    pageaction(unsigned k, const libconfig::Setting& setting, key_model& keys_, unsigned to_page_, direction dir, deck_config& deck_)
+    : base_type(k, setting, keys_, dir == direction::left ? "left-arrow.png" : "right-arrow.png"), to_page(to_page_), deck(deck_) {}
 
     void call() override;
 
@@ -389,6 +641,33 @@ namespace {
   };
 
 
+  // Key showing an animation instead of a fixed icon.  Presses are handled by the action
+  // the key is configured with.
+  struct animated final : public action {
+    using base_type = action;
+
+    animated(unsigned k, key_model& keys_, std::unique_ptr<action>&& inner_, animator& animations_, std::vector<animator::frame>&& frames, std::function<bool()> visible)
+    : base_type(k, keys_), inner(std::move(inner_)), animations(animations_),
+      id(animations.add(std::move(frames), [this, visible](int handle){ if (visible()) keys.set(key, handle); }))
+    {
+    }
+    ~animated() { animations.remove(id); }
+
+    void call() override {
+      inner->call();
+    }
+
+    void show_icon() override {
+      keys.set(key, animations.current(id));
+    }
+
+  private:
+    std::unique_ptr<action> inner;
+    animator& animations;
+    const animator::id_type id;
+  };
+
+
   struct deck_config {
     deck_config(const std::filesystem::path& conffile);
 
@@ -399,10 +678,13 @@ namespace {
   private:
     static unsigned keyidx(unsigned page, unsigned k) { return page * 256 + k; }
 
-    void setkey(unsigned page, unsigned row, unsigned column, Magick::Image&& image);
+    void setkey(unsigned page, unsigned row, unsigned column, const rgba_buffer& buffer);
     void setkey(unsigned page, unsigned row, unsigned column, int handle);
 
-    int register_image(Magick::Image&& image);
+    int register_image(Magick::Image&& image) { return ::register_image(*dev, std::move(image)); }
+
+    std::chrono::milliseconds frame_time{ 50 };
+    std::vector<animator::frame> animation_frames(const libconfig::Setting& key);
 
     void handle_idle();
     bool prohibit_sleep() const {
@@ -422,25 +704,78 @@ namespace {
     unsigned brightness_idle;
     std::thread idle_thread;
 
+    // The fonts are loaded in the background while the devices are enumerated.
+    ftlibrary ftobj;
     streamdeck::context ctx;
+    startup::mark ctx_done{ "enumerate devices" };
     streamdeck::device_type* dev = nullptr;
+    // All key images are sent through the model.
+    std::unique_ptr<key_model> keymodel;
 
-    bool has_keylights = false;
-    keylightpp::device_list_type keylights;
     xdo_t* xdo = nullptr;
     unsigned nrpages = 1;
     unsigned current_page = 0;
+    // The animations are removed when the actions are destroyed.
+    std::unique_ptr<animator> animations;
     std::map<unsigned,std::unique_ptr<action>> actions;
     std::unique_ptr<obs::info> obs;
-    ftlibrary ftobj;
     int blankimg;
+
+    // The discovery thread uses the actions and must be stopped first.
+    keylight_discovery keylights;
+    std::vector<unsigned> keylight_keys;
+    void keylights_found();
+
+    // Keys are painted by the main thread and the keylight discovery.
+    std::mutex paint_m;
+    bool painted = false;
   };
 
 
+  // Decode the icons named in the configuration of the keys in the background while the
+  // keys are set up.  The icons of OBS keys are loaded when needed.
+  std::vector<std::jthread> prefetch_images(const libconfig::Setting& keys)
+  {
+    auto names = std::make_shared<std::vector<std::string>>();
+    for (const auto& page : keys)
+      for (const auto& key : page)
+        if (key.isGroup())
+          for (auto setting : { "icon", "icon_on", "icon_off" })
+            if (std::string name; key.lookupValue(setting, name)) {
+              // Animated images are decoded frame by frame when the key is set up.
+              auto ext = std::filesystem::path(name).extension();
+              if (ext != ".gif" && ext != ".apng")
+                names->emplace_back(std::move(name));
+            }
+    std::ranges::sort(*names);
+    names->erase(std::unique(names->begin(), names->end()), names->end());
+
+    auto next = std::make_shared<std::atomic<size_t>>(0);
+    std::vector<std::jthread> res;
+    auto nthreads = std::min<size_t>(names->size(), std::max(1u, std::thread::hardware_concurrency()));
+    for (size_t t = 0; t < nthreads; ++t)
+      res.emplace_back([names,next]{
+        for (size_t i; (i = (*next)++) < names->size(); )
+          try {
+            (void) find_image((*names)[i]);
+          }
+          catch (...) {
+            // The error is reported when the key is set up.
+          }
+      });
+    return res;
+  }
+
+
   deck_config::deck_config(const std::filesystem::path& conffile)
   {
     libconfig::Config config;
     config.readFile(conffile.c_str());
+    startup::lap("read configuration");
+
+    std::vector<std::jthread> prefetch;
+    if (config.exists("keys"))
+      prefetch = prefetch_images(config.lookup("keys"));
 
     std::string serial;
     if (! config.lookupValue("serial", serial))
@@ -458,15 +793,25 @@ namespace {
 
     if (dev == nullptr)
       throw std::runtime_error("no device available");
+    keymodel = std::make_unique<key_model>(*dev);
+    startup::lap("open device");
 
     if (! config.lookupValue("pages", nrpages))
       nrpages = 1;
 
+    if (unsigned rate; config.lookupValue("frame_rate", rate) && rate > 0)
+      frame_time = std::chrono::milliseconds(std::max(1u, 1000 / rate));
+
+    bool sdf_labels;
+    if (config.lookupValue("sdf_labels", sdf_labels) && sdf_labels && ! ftobj.enable_sdf())
+      std::cerr << "signed distance field rendering not supported, using outlines\n";
+
     if (config.exists("obs")) {
       auto& group = config.lookup("obs");
       if (group.isGroup())
         obs = std::make_unique<obs::info>(group, ftobj, [this](Magick::Image&& image) { return register_image(std::move(image)); });
     }
+    startup::lap("set up OBS");
 
     if (! config.lookupValue("brightness", brightness))
       brightness = 100;
@@ -517,39 +862,31 @@ namespace {
               std::string serial;
               bool has_serial = key.lookupValue("serial", serial);
 
-              if (! has_keylights) {
-                has_keylights = true;
-                for (unsigned t = 0; t < 3; ++t) {
-                  keylights = keylightpp::discover();
-                  if (keylights.begin() != keylights.end())
-                    break;
-                  sleep(1);
-                }
-                if (keylights.begin() == keylights.end()) {
-                  has_keylights = false;
-                  continue;
-                }
+              if (! keylights.started()) {
+                keylights.placeholder = register_image(find_image("blank.png"));
+                keylights.start([this]{ keylights_found(); });
               }
+              keylight_keys.push_back(kidx);
 
               if (std::string(key["function"]) == "on/off")
-                actions[kidx] = std::make_unique<keylight_toggle>(k, key, *dev, has_serial, serial, keylights);
+                actions[kidx] = std::make_unique<keylight_toggle>(k, key, *keymodel, has_serial, serial, keylights);
               else if (std::string(key["function"]) == "brightness+")
-                actions[kidx] = std::make_unique<keylight_brightness>(k, key, *dev, has_serial, serial, keylights, 5);
+                actions[kidx] = std::make_unique<keylight_brightness>(k, key, *keymodel, has_serial, serial, keylights, 5);
               else if (std::string(key["function"]) == "brightness-")
-                actions[kidx] = std::make_unique<keylight_brightness>(k, key, *dev, has_serial, serial, keylights, -5);
+                actions[kidx] = std::make_unique<keylight_brightness>(k, key, *keymodel, has_serial, serial, keylights, -5);
               else if (std::string(key["function"]) == "color+")
-                actions[kidx] = std::make_unique<keylight_color>(k, key, *dev, has_serial, serial, keylights, 250);
+                actions[kidx] = std::make_unique<keylight_color>(k, key, *keymodel, has_serial, serial, keylights, 250);
               else if (std::string(key["function"]) == "color-")
-                actions[kidx] = std::make_unique<keylight_color>(k, key, *dev, has_serial, serial, keylights, -250);
+                actions[kidx] = std::make_unique<keylight_color>(k, key, *keymodel, has_serial, serial, keylights, -250);
             } else if (std::string(key["type"]) == "execute" && key.exists("command"))
-              actions[kidx] = std::make_unique<execute>(k, key, *dev, std::string(key["command"]));
+              actions[kidx] = std::make_unique<execute>(k, key, *keymodel, std::string(key["command"]));
             else if (std::string(key["type"]) == "key" && key.exists("sequence")) {
               if (xdo == nullptr)
                 xdo = xdo_new(nullptr);
               if (xdo != nullptr) {
                 auto& seq = key.lookup("sequence");
                 if (seq.isScalar())
-                  actions[kidx] = std::make_unique<keypress>(k, key, *dev, std::string(seq), xdo);
+                  actions[kidx] = std::make_unique<keypress>(k, key, *keymodel, std::string(seq), xdo);
                 else if (seq.isList() && seq.getLength() > 0) {
                   std::list<std::string> l;
                   for (auto& sseq : seq) {
@@ -560,7 +897,7 @@ namespace {
                     l.emplace_back(std::string(sseq));
                   }
                   if (l.size() > 0)
-                    actions[kidx] = std::make_unique<keypress>(k, key, *dev, std::move(l), xdo);
+                    actions[kidx] = std::make_unique<keypress>(k, key, *keymodel, std::move(l), xdo);
                 }
               }
             } else if (obs && std::string(key["type"]) == "tasmota") {
@@ -568,14 +905,20 @@ namespace {
               std::string icon_off = key.exists("icon_off") ? key["icon_off"] : "";
               std::string icon_on = key.exists("icon_on") ? key["icon_on"] : "";
               if (! device.empty() && ! icon_off.empty() && ! icon_on.empty())
-                actions[kidx] = std::make_unique<tasmota>(k, key, *dev, std::move(device), std::move(icon_off), std::move(icon_on));
+                actions[kidx] = std::make_unique<tasmota>(k, key, *keymodel, std::move(device), std::move(icon_off), std::move(icon_on));
             } else if (obs && std::string(key["type"]) == "obs") {
-              if (auto b = obs->parse_key([this](unsigned page, unsigned row, unsigned column, Magick::Image&& image){ setkey(page, row, column, std::move(image)); }, [this](unsigned page, unsigned row, unsigned column, int handle){ setkey(page, row, column, handle); }, pagenr, row, column, key); b != nullptr)
-                actions[kidx] = std::make_unique<obsaction>(k, key, *dev, b);
+              if (auto b = obs->parse_key([this](unsigned page, unsigned row, unsigned column, const rgba_buffer& buffer){ setkey(page, row, column, buffer); }, [this](unsigned page, unsigned row, unsigned column, int handle){ setkey(page, row, column, handle); }, pagenr, row, column, key); b != nullptr)
+                actions[kidx] = std::make_unique<obsaction>(k, key, *keymodel, b);
             } else if (std::string(key["type"]) == "nextpage")
-              actions[kidx] = std::make_unique<pageaction>(k, key, *dev, (pagenr + 1) % nrpages, pageaction::direction::right, *this);
+              actions[kidx] = std::make_unique<pageaction>(k, key, *keymodel, (pagenr + 1) % nrpages, pageaction::direction::right, *this);
             else if (std::string(key["type"]) == "prevpage")
-              actions[kidx] = std::make_unique<pageaction>(k, key, *dev, (pagenr - 1 + nrpages) % nrpages, pageaction::direction::left, *this);
+              actions[kidx] = std::make_unique<pageaction>(k, key, *keymodel, (pagenr - 1 + nrpages) % nrpages, pageaction::direction::left, *this);
+
+            // Only keys which always show the configured icon can be animated.
+            if (auto type = std::string(key["type"]); type == "execute" || type == "key" || type == "nextpage" || type == "prevpage")
+              if (auto it = actions.find(kidx); it != actions.end())
+                if (auto frames = animation_frames(key); ! frames.empty())
+                  it->second = std::make_unique<animated>(k, *keymodel, std::move(it->second), *animations, std::move(frames), [this, pagenr]{ return current_page == pagenr; });
           }
         }
       }
@@ -585,39 +928,121 @@ namespace {
     }
 
     dev->set_brightness(brightness);
-    blankimg = dev->register_image(find_image("blank.png"));
+    blankimg = register_image(find_image("blank.png"));
+    startup::lap("configure keys");
+  }
+
+
+  // The frames of the animation configured for KEY.  The setting "animation" selects
+  // "blink" (alternate with a blank key), "pulse" (cycle the brightness of the icon), or
+  // "frames" (the frames of an animated image, the default for GIF and APNG icons).  The
+  // setting "period" is the length of a cycle of blink or pulse in milliseconds.  All
+  // frames are registered with the device here, the animation only switches handles.
+  std::vector<animator::frame> deck_config::animation_frames(const libconfig::Setting& key)
+  {
+    std::string iconname;
+    if (! key.lookupValue("icon", iconname))
+      return { };
+
+    std::string kind;
+    if (! key.lookupValue("animation", kind)) {
+      auto ext = std::filesystem::path(iconname).extension();
+      if (ext != ".gif" && ext != ".apng")
+        return { };
+      kind = "frames";
+    }
+
+    if (! animations)
+      animations = std::make_unique<animator>(frame_time);
+
+    unsigned period_ms;
+    if (! key.lookupValue("period", period_ms) || period_ms == 0)
+      period_ms = kind == "pulse" ? 2000 : 1000;
+    std::chrono::milliseconds period(period_ms);
+
+    std::vector<animator::frame> res;
+    if (kind == "blink") {
+      auto t = animations->ticks(period / 2);
+      res.emplace_back(register_image(find_image(iconname)), t);
+      res.emplace_back(register_image(find_image("blank.png")), t);
+    } else if (kind == "pulse") {
+      // Ping-pong over the brightness levels, like the FTB animation.
+      static constexpr unsigned nlevels = 8;
+      static constexpr double min_level = 40.0;
+      std::vector<int> levels;
+      for (unsigned i = 0; i < nlevels; ++i) {
+        auto image = find_image(iconname);
+        if (i > 0)
+          image.modulate(100.0 - (100.0 - min_level) * i / (nlevels - 1), 100.0, 100.0);
+        levels.push_back(register_image(std::move(image)));
+      }
+      auto t = animations->ticks(period / (2 * (nlevels - 1)));
+      for (unsigned i = 0; i < nlevels; ++i)
+        res.emplace_back(levels[i], t);
+      for (unsigned i = nlevels - 2; i > 0; --i)
+        res.emplace_back(levels[i], t);
+    } else if (kind == "frames") {
+      for (auto& image : find_frames(iconname)) {
+        // The delay is given in hundredths of a second.  Like browsers, treat very short
+        // delays as unset.
+        auto delay = image.animationDelay();
+        std::chrono::milliseconds d(delay <= 1 ? 100 : 10 * delay);
+        res.emplace_back(register_image(std::move(image)), animations->ticks(d));
+      }
+      if (res.size() == 1)
+        // Nothing to animate.
+        res.clear();
+    } else
+      std::cerr << "unknown animation " << kind << '\n';
+
+    return res;
   }
 
 
-  int deck_config::register_image(Magick::Image&& image)
+  void deck_config::keylights_found()
   {
-    return dev->register_image(std::move(image));
+    // Before the first painting of the keys nothing has to be done.
+    std::lock_guard<std::mutex> guard(paint_m);
+    if (! painted)
+      return;
+
+    for (auto kidx : keylight_keys)
+      if (auto it = actions.find(kidx); it != actions.end() && kidx == keyidx(current_page, kidx % 256))
+        it->second->show_icon();
   }
 
 
-  void deck_config::setkey(unsigned page, unsigned row, unsigned column, Magick::Image&& image)
+  void deck_config::setkey(unsigned page, unsigned row, unsigned column, const rgba_buffer& buffer)
   {
+    // streamdeckpp only accepts Magick::Image objects and converts them to the format of
+    // the device itself.  Both conversions are skipped for keys which are not shown or
+    // which already show the same pixels.
     if (page == current_page)
-      dev->set_key_image(row - 1u, column - 1u, std::move(image));
+      keymodel->set(page, (row - 1u) * dev->key_cols + column - 1u, buffer);
   }
 
 
   void deck_config::setkey(unsigned page, unsigned row, unsigned column, int handle)
   {
     if (page == current_page)
-      dev->set_key_image(row - 1u, column - 1u, handle);
+      keymodel->set(page, (row - 1u) * dev->key_cols + column - 1u, handle);
   }
 
 
   void deck_config::show_icons()
   {
+    std::lock_guard<std::mutex> guard(paint_m);
+    painted = true;
+
+    // Keys which look the same on the new page are not written again.
+    key_frame frame;
     for (unsigned k = 0; k < dev->key_count; ++k) {
       unsigned kidx = keyidx(current_page, k);
 
       if (actions.contains(kidx))
         actions[kidx]->show_icon();
       else
-        dev->set_key_image(k, blankimg);
+        keymodel->set(k, blankimg);
     }
   }
 
@@ -625,8 +1050,13 @@ namespace {
   void deck_config::run()
   {
     show_icons();
+    startup::lap("paint keys");
+    startup::finish();
+    if (obs)
+      obs->warm_icons();
 
     signal(SIGTERM, SIG_DFL);
+    signal(SIGUSR1, [](int){ key_model::report(STDERR_FILENO); });
 
     while (true) {
       auto ss = dev->read();
@@ -645,6 +1075,8 @@ namespace {
 
   void deck_config::nextpage(unsigned to_page) {
     current_page = to_page;
+    // Writes for the old page still recorded in frames of other threads are dropped.
+    keymodel->show_page(to_page);
     show_icons();
   }
 
@@ -939,10 +1371,28 @@ namespace {
 
 int main(int argc, char* argv[])
 {
+  // -p prints the time of the startup phases, -t FILE writes them as a trace.
+  bool print_startup = false;
+  std::filesystem::path startup_trace;
+  int opt;
+  while ((opt = getopt(argc, argv, "pt:")) != -1)
+    switch (opt) {
+    case 'p':
+      print_startup = true;
+      break;
+    case 't':
+      startup_trace = optarg;
+      break;
+    default:
+      error(EXIT_FAILURE, 0, "usage: %s [-p] [-t TRACEFILE] [CONFIGFILE]", argv[0]);
+    }
+  startup::enable(print_startup, startup_trace);
+
   auto resource_bundle = Glib::wrap(resources_get_resource());
   resource_bundle->register_global();
+  startup::lap("register resources");
 
-  auto conffile = argc == 2 ? std::filesystem::path(argv[1]) : (get_homedir() / ".config/streamdeckd.conf");
+  auto conffile = optind + 1 == argc ? std::filesystem::path(argv[optind]) : (get_homedir() / ".config/streamdeckd.conf");
   deck_config deck(conffile);
 
   deck.run();
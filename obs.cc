@@ -2,14 +2,20 @@
 
 #include <cassert>
 #include <iterator>
+#include <iostream>
+#include <set>
 #include <filesystem>
 
 #include <json/forwards.h>
 #include <openssl/evp.h>
 #include <openssl/sha.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 #include "obsws.hh"
 #include "buttontext.hh"
+#include "keymodel.hh"
+#include "startup.hh"
 
 using namespace std::string_literals;
 using namespace std::literals::chrono_literals;
@@ -33,16 +39,59 @@ namespace obs {
     std::string password("");
     std::string log("");
 
+
+    // Long names are split at whitespace, one word per line.
+    std::vector<std::string> split_label(const std::string& name)
+    {
+      if (name.size() <= 5)
+        return { name };
+
+      std::istringstream iss(name);
+      return std::vector(std::istream_iterator<std::string>{iss}, std::istream_iterator<std::string>());
+    }
+
+
+    // Redraw the buttons for number NR.
+    template<typename B>
+    void show_icons(std::unordered_multimap<unsigned,B>& buttons, unsigned nr)
+    {
+      auto r = buttons.equal_range(nr);
+      for (auto it = r.first; it != r.second; ++it)
+        it->second.show_icon();
+    }
+
+
+    // Stand-ins for unknown scenes and transitions.
+    const scene no_scene;
+    const transition no_transition;
+
   } // anonymous namespace;
 
 
-  button::button(unsigned nr_, set_key_image_cb setkey_image_, set_key_handle_cb setkey_handle_, info* i_, unsigned page_, unsigned row_, unsigned column_, int icon1_, int icon2_, keyop_type keyop_)
-  : nr(nr_), setkey_image(setkey_image_), setkey_handle(setkey_handle_), i(i_), page(page_), row(row_), column(column_), icon1(icon1_), icon2(icon2_), keyop(keyop_)
+  lazy_icon::lazy_icon(const register_image_cb& register_image, const std::string& name)
+  : s(std::make_shared<state>(register_image, name))
   {
   }
 
 
-  void button::show_icon()
+  int lazy_icon::get() const
+  {
+    if (! s)
+      return -1;
+    // If loading fails the exception is passed on.  Neither call_once nor find_image
+    // remember the failure, the next use tries again.
+    std::call_once(s->once, [this]{ s->handle = s->register_image(find_image(s->name)); });
+    return s->handle;
+  }
+
+
+  button::button(unsigned nr_, set_key_buffer_cb setkey_buffer_, set_key_handle_cb setkey_handle_, info* i_, unsigned page_, unsigned row_, unsigned column_, lazy_icon icon1_, lazy_icon icon2_, keyop_type keyop_)
+  : nr(nr_), setkey_buffer(setkey_buffer_), setkey_handle(setkey_handle_), i(i_), page(page_), row(row_), column(column_), icon1(std::move(icon1_)), icon2(std::move(icon2_)), keyop(keyop_)
+  {
+  }
+
+
+  void button::prepare(render_pool::context*)
   {
     auto icon = i->obsicon;
 
@@ -70,7 +119,13 @@ namespace obs {
         icon = icon1;
     }
 
-    setkey_handle(page, row, column, icon);
+    pending = icon;
+  }
+
+
+  void button::upload()
+  {
+    setkey_handle(page, row, column, pending);
   }
 
 
@@ -91,12 +146,8 @@ namespace obs {
       if (nr <= i->scene_count()) {
         if (i->ftb.active()) {
           if (! i->studio_mode && i->saved_scene != i->get_scene_name(nr)) {
-            auto& oldscene = i->scenes[i->saved_scene];
             i->saved_scene = i->get_scene_name(nr);
-            for (auto& b : i->scene_live_buttons)
-              if (b.second.nr == oldscene.nr)
-                b.second.show_icon();
-            show_icon();
+            request_icon();
           }
         } else {
           d["requestType"] = "SetCurrentProgramScene";
@@ -158,9 +209,9 @@ namespace obs {
           batch["requests"].append(d);
         }
         obsws::batch(batch);
-        i->ftb.start();
+        i->start_ftb();
       } else {
-        i->ftb.stop();
+        i->stop_ftb();
         if (i->studio_mode) {
           d.clear();
           d["requestType"] = "TriggerStudioModeTransition";
@@ -196,16 +247,9 @@ namespace obs {
       break;
     case keyop_type::source:
       assert(nr > 0);
-      if (nr <= i->current_sources.size() && (! i->ftb.active() || i->studio_mode)) {
-        d["requestType"] = "SetSceneItemEnabled";
-        d["requestData"]["sceneName"] = i->studio_mode ? i->current_preview : i->current_scene;
-        d["requestData"]["sceneItemId"] = i->current_sources[nr - 1].id;
-        d["requestData"]["sceneItemEnabled"] = ! i->current_sources[nr - 1].enabled;
-        obsws::emit(d);
-
-        i->current_sources[nr - 1].enabled = ! i->current_sources[nr - 1].enabled;
-        show_icon();
-      }
+      // The scenes and their items belong to the worker.
+      if (i->key_queue.push(work_request::make<work_request::work_type::toggle_source>({ nr })))
+        i->wake_worker();
       break;
     default:
       break;
@@ -213,119 +257,213 @@ namespace obs {
   }
 
 
-  void auto_button::show_icon()
+  void button::request_icon()
+  {
+    i->buttons_due = true;
+    i->wake_worker();
+  }
+
+
+  void auto_button::prepare(render_pool::context* ctx)
   {
     if (i->connected && i->studio_mode && ! i->ftb.active()) {
-      font_render<render_to_image> renderobj(fontobj, background, 0.8, 0.3);
+      font_render<render_to_rgba_buffer&> renderobj(ctx ? ctx->face(font) : fontobj, renderer);
       auto s = std::to_string(duration_ms / 1000.0);
       if (s.size() == 1)
         s += ".0";
       else if (s.size() > 3)
         s.erase(3);
-      setkey_image(page, row, column, renderobj.draw(s, color, std::get<0>(center), std::get<1>(center)));
+      renderobj.draw(s, color, std::get<0>(center), std::get<1>(center));
+      // The buffer is shown.
+      pending = -1;
     } else
-      setkey_handle(page, row, column, i->obsicon);
+      pending = i->obsicon;
+  }
+
+
+  void auto_button::upload()
+  {
+    if (pending < 0)
+      setkey_buffer(page, row, column, buffer);
+    else
+      setkey_handle(page, row, column, pending);
   }
 
 
-  void scene_button::show_icon()
+  void scene_button::prepare(render_pool::context* ctx)
   {
     if (i->connected && (keyop != keyop_type::preview_scene || i->studio_mode)) {
-      auto it = std::find_if(i->scenes.begin(), i->scenes.end(), [nr = base_type::nr](const auto& e){ return nr == e.second.nr; });
-      if (it != i->scenes.end()) {
-        auto name = it->second.name;
-        std::vector<std::string> vs;
-        if (name.size() <= 5)
-          vs.emplace_back(name);
-        else {
-          std::istringstream iss(name);
-          vs = std::vector(std::istream_iterator<std::string>{iss}, std::istream_iterator<std::string>());
-        }
+      if (auto s = i->scenes.find(nr)) {
+        auto vs = split_label(s->name);
 
-        if ((keyop == keyop_type::live_scene && i->get_current_scene().nr == nr) || (keyop == keyop_type::preview_scene && i->get_current_preview().nr == nr)) {
-          font_render<render_to_image> renderobj(fontobj, background, 0.8, 0.8);
-          setkey_image(page, row, column, renderobj.draw(vs, keyop == keyop_type::live_scene ? i->im_white : i->im_black, 0.5, 0.5));
-        } else {
-          font_render<render_to_image> renderobj(fontobj, background_off, 0.8, 0.8);
-          setkey_image(page, row, column, renderobj.draw(vs, i->im_darkgray, 0.5, 0.5));
-        }
+        if ((keyop == keyop_type::live_scene && i->get_current_scene().nr == nr) || (keyop == keyop_type::preview_scene && i->get_current_preview().nr == nr))
+          pending = i->label_icon(vs, ctx ? ctx->face(font) : fontobj, font, background_name, keyop == keyop_type::live_scene ? i->im_white : i->im_black);
+        else
+          pending = i->label_icon(vs, ctx ? ctx->face(font) : fontobj, font, background_off_name, i->im_darkgray);
         return;
       }
     }
-    setkey_handle(page, row, column, keyop == keyop_type::live_scene ? i->live_unused_icon : (! i->connected || i->studio_mode ? i->preview_unused_icon : i->obsicon));
+    pending = keyop == keyop_type::live_scene ? i->live_unused_icon : (! i->connected || i->studio_mode ? i->preview_unused_icon : i->obsicon);
   }
 
 
-  void transition_button::show_icon()
+  void transition_button::prepare(render_pool::context* ctx)
   {
     if (i->connected && ! i->ftb.active()) {
-      auto it = std::find_if(i->transitions.begin(), i->transitions.end(), [nr = base_type::nr](const auto& e){ return nr == e.second.nr; });
-      if (it != i->transitions.end()) {
-        auto name = it->second.name;
-        std::vector<std::string> vs;
-        if (name.size() <= 5)
-          vs.emplace_back(name);
-        else {
-          std::istringstream iss(name);
-          vs = std::vector(std::istream_iterator<std::string>{iss}, std::istream_iterator<std::string>());
-        }
+      if (auto t = i->transitions.find(nr)) {
+        auto vs = split_label(t->name);
 
-        if (i->get_current_transition().nr == nr) {
-          font_render<render_to_image> renderobj(fontobj, background, 0.8, 0.8);
-          setkey_image(page, row, column, renderobj.draw(vs, i->im_black, 0.5, 0.5));
-        } else {
-          font_render<render_to_image> renderobj(fontobj, background_off, 0.8, 0.8);
-          setkey_image(page, row, column, renderobj.draw(vs, i->im_darkgray, 0.5, 0.5));
-        }
+        if (i->get_current_transition().nr == nr)
+          pending = i->label_icon(vs, ctx ? ctx->face(font) : fontobj, font, background_name, i->im_black);
+        else
+          pending = i->label_icon(vs, ctx ? ctx->face(font) : fontobj, font, background_off_name, i->im_darkgray);
         return;
       }
     }
-    setkey_handle(page, row, column, i->transition_unused_icon);
+    pending = i->transition_unused_icon;
   }
 
 
-  void source_button::show_icon()
+  void source_button::prepare(render_pool::context* ctx)
   {
     if (i->connected && (! i->ftb.active() || i->studio_mode)) {
       unsigned idx = base_type::nr - 1;
-      if (idx < i->current_sources.size()) {
-        auto& str = i->current_sources[idx].name;
-        std::vector<std::string> vs;
-        if (str.size() <= 5)
-          vs.emplace_back(str);
-        else {
-          std::istringstream iss(str);
-          vs = std::vector(std::istream_iterator<std::string>{iss}, std::istream_iterator<std::string>());
-        }
+      if (auto& items = i->shown_items(); idx < items.size()) {
+        auto vs = split_label(items[idx].name);
 
-        if (i->current_sources[idx].enabled) {
-          font_render<render_to_image> renderobj(fontobj, background, 0.8, 0.8);
-          setkey_image(page, row, column, renderobj.draw(vs, i->im_black, 0.5, 0.5));
-        } else {
-          font_render<render_to_image> renderobj(fontobj, background_off, 0.8, 0.8);
-          setkey_image(page, row, column, renderobj.draw(vs, i->im_darkgray, 0.5, 0.5));
-        }
+        if (items[idx].enabled)
+          pending = i->label_icon(vs, ctx ? ctx->face(font) : fontobj, font, background_name, i->im_black);
+        else
+          pending = i->label_icon(vs, ctx ? ctx->face(font) : fontobj, font, background_off_name, i->im_darkgray);
         return;
       }
     }
-    setkey_handle(page, row, column, i->source_unused_icon);
+    pending = i->source_unused_icon;
+  }
+
+
+  std::optional<int> label_cache::find(const key_type& key)
+  {
+    std::lock_guard<std::mutex> guard(m);
+    if (auto it = handles.find(key); it != handles.end()) {
+      lru.splice(lru.begin(), lru, it->second);
+      return it->second->second;
+    }
+    return std::nullopt;
+  }
+
+
+  int label_cache::insert(key_type&& key, int handle)
+  {
+    std::lock_guard<std::mutex> guard(m);
+    // If another thread rendered the same label in the meantime keep the first handle.
+    if (auto it = handles.find(key); it != handles.end()) {
+      lru.splice(lru.begin(), lru, it->second);
+      return it->second->second;
+    }
+
+    lru.emplace_front(std::move(key), handle);
+    handles.emplace(lru.front().first, lru.begin());
+    if (lru.size() > capacity) {
+      handles.erase(lru.back().first);
+      lru.pop_back();
+    }
+    return handle;
+  }
+
+
+  label_cache::key_type info::label_key(const std::vector<std::string>& vs, const std::string& font, const std::string& background_name, const Magick::Color& foreground, double widthfactor, double heightfactor, double posx, double posy)
+  {
+    label_cache::key_type key;
+    for (const auto& s : vs) {
+      if (! key.text.empty())
+        key.text += '\n';
+      key.text += s;
+    }
+    key.font = font;
+    key.background = background_name;
+    key.foreground = { foreground.quantumRed(), foreground.quantumGreen(), foreground.quantumBlue(), foreground.quantumAlpha() };
+    key.fit = { widthfactor, heightfactor };
+    key.pos = { posx, posy };
+    return key;
+  }
+
+
+  int info::label_icon(const std::vector<std::string>& vs, ftface& fontobj, const std::string& font, const std::string& background_name, const Magick::Color& foreground, double widthfactor, double heightfactor, double posx, double posy)
+  {
+    auto key = label_key(vs, font, background_name, foreground, widthfactor, heightfactor, posx, posy);
+
+    if (auto handle = labels.find(key); handle)
+      return *handle;
+
+    font_render<render_to_image> renderobj(fontobj, find_image(background_name), widthfactor, heightfactor);
+    return labels.insert(std::move(key), register_image(renderobj.draw(vs, foreground, posx, posy)));
+  }
+
+
+  void info::prerender_labels(button_class bc)
+  {
+    std::vector<render_pool::job_type> jobs;
+    std::set<label_cache::key_type> seen;
+    auto add = [this,&jobs,&seen](std::vector<std::string>&& vs, const std::string& font, const std::string& background_name, const Magick::Color& foreground) {
+      if (seen.insert(label_key(vs, font, background_name, foreground, 0.8, 0.8, 0.5, 0.5)).second)
+        jobs.emplace_back([this,vs=std::move(vs),&font,&background_name,&foreground](render_pool::context& ctx) {
+          (void) label_icon(vs, ctx.face(font), font, background_name, foreground);
+        });
+    };
+
+    if ((bc & button_class::live) != button_class::none)
+      for (const auto& [nr, b] : scene_live_buttons)
+        if (auto s = scenes.find(nr)) {
+          add(split_label(s->name), b.font, b.background_name, im_white);
+          add(split_label(s->name), b.font, b.background_off_name, im_darkgray);
+        }
+    if ((bc & button_class::preview) != button_class::none && studio_mode)
+      for (const auto& [nr, b] : scene_preview_buttons)
+        if (auto s = scenes.find(nr)) {
+          add(split_label(s->name), b.font, b.background_name, im_black);
+          add(split_label(s->name), b.font, b.background_off_name, im_darkgray);
+        }
+    if ((bc & button_class::transition) != button_class::none)
+      for (const auto& [nr, b] : transition_buttons)
+        if (auto t = transitions.find(nr)) {
+          add(split_label(t->name), b.font, b.background_name, im_black);
+          add(split_label(t->name), b.font, b.background_off_name, im_darkgray);
+        }
+    // Only the items of the shown scene.  Those of all scenes would not fit into the label
+    // cache for large scene collections.
+    if ((bc & button_class::sources) != button_class::none) {
+      auto& items = shown_items();
+      for (const auto& [nr, b] : source_buttons)
+        if (nr - 1 < items.size()) {
+          add(split_label(items[nr - 1].name), b.font, b.background_name, im_black);
+          add(split_label(items[nr - 1].name), b.font, b.background_off_name, im_darkgray);
+        }
+    }
+
+    startup::scope timing("prerender labels", std::to_string(jobs.size()));
+    renderers.run(std::move(jobs));
   }
 
 
   info::info(const libconfig::Setting& config, ftlibrary& ftobj_, register_image_cb register_image_)
-  : register_image(register_image_), ftobj(ftobj_), im_black("black"), im_white("white"), im_darkgray("darkgray"),
-    obsicon(register_image(find_image("obs.png"))),
-    live_unused_icon(register_image(find_image("scene_live_unused.png"))),
-    preview_unused_icon(register_image(find_image("scene_preview_unused.png"))),
-    source_unused_icon(register_image(find_image("source_unused.png"))),
-    transition_unused_icon(register_image(find_image("transition_unused.png"))),
-    ftb { .icons = { register_image(find_image("ftb-0.png")), register_image(find_image("ftb-12.png")),
-                     register_image(find_image("ftb-25.png")), register_image(find_image("ftb-37.png")),
-                     register_image(find_image("ftb-50.png")), register_image(find_image("ftb-62.png")),
-                     register_image(find_image("ftb-75.png")), register_image(find_image("ftb-87.png")),
-                     register_image(find_image("ftb-100.png")) } },
+  : register_image(register_image_), ftobj(ftobj_),
+    renderers(ftobj_, config.exists("render_threads") ? unsigned(int(config["render_threads"])) : std::min(4u, std::thread::hardware_concurrency())),
+    im_black("black"), im_white("white"), im_darkgray("darkgray"),
+    obsicon(make_icon("obs.png")),
+    live_unused_icon(make_icon("scene_live_unused.png")),
+    preview_unused_icon(make_icon("scene_preview_unused.png")),
+    source_unused_icon(make_icon("source_unused.png")),
+    transition_unused_icon(make_icon("transition_unused.png")),
+    ftb { .icons = { make_icon("ftb-0.png"), make_icon("ftb-12.png"), make_icon("ftb-25.png"),
+                     make_icon("ftb-37.png"), make_icon("ftb-50.png"), make_icon("ftb-62.png"),
+                     make_icon("ftb-75.png"), make_icon("ftb-87.png"), make_icon("ftb-100.png") } },
     obsfont(config.exists("font") ? std::string(config["font"]) : "Arial"s)
   {
+    if (config.exists("prerender"))
+      prerender = bool(config["prerender"]);
+    if (config.exists("warm_icons"))
+      warm = bool(config["warm_icons"]);
     if (config.exists("server"))
       server = std::string(config["server"]);
     else
@@ -351,116 +489,241 @@ namespace obs {
     else
       open = "";
 
+    // Events can arrive as soon as the connection is started.
+    worker_efd = eventfd(0, EFD_CLOEXEC);
+    if (worker_efd == -1)
+      throw std::system_error(errno, std::system_category(), "eventfd");
+
+    startup::scope timing("start OBS connection");
     obsws::config([this](const Json::Value& val){ callback(val); }, [this](bool connected){ connection_update(connected); }, server.c_str(), port, password, log.c_str());
 
     worker = std::thread([this]{ worker_thread(); });
   }
 
 
+  lazy_icon info::make_icon(const std::string& name)
+  {
+    return icons.emplace_back(register_image, name);
+  }
+
+
+  void info::warm_icons()
+  {
+    if (! warm || warmer.joinable())
+      return;
+
+    warmer = std::thread([this]{
+      for (const auto& icon : icons)
+        try {
+          (void) icon.get();
+        }
+        catch (...) {
+          // Reported when the icon is used.
+        }
+    });
+  }
+
+
   info::~info()
   {
+    if (warmer.joinable())
+      warmer.join();
     terminate = true;
-    worker_cv.notify_all();
+    wake_worker();
     worker.join();
+    // The FTB timer callback uses the eventfd.
+    timers.shutdown();
+    close(worker_efd);
   }
 
 
-  work_request info::get_request()
+  namespace {
+
+    // Requests which only carry the latest state of something.  Of several requests with
+    // the same key only the last one has to be handled.
+    std::optional<std::tuple<work_request::work_type,std::string,unsigned>> supersede_key(const work_request& req)
+    {
+      using work_type = work_request::work_type;
+      switch (req.type()) {
+      case work_type::buttons:
+      case work_type::scene:
+      case work_type::preview:
+      case work_type::duration:
+      case work_type::ftb_frame:
+        return std::tuple(req.type(), std::string(), 0u);
+      case work_type::sourceorder:
+        return std::tuple(req.type(), req.get<work_type::sourceorder>().scene, 0u);
+      case work_type::visible:
+        return std::tuple(req.type(), req.get<work_type::visible>().scene, req.get<work_type::visible>().id);
+      default:
+        return std::nullopt;
+      }
+    }
+
+
+    // Remove the requests which are superseded by later ones.  The order of the remaining
+    // requests is kept.
+    void coalesce(std::deque<work_request>& reqs)
+    {
+      if (reqs.size() < 2)
+        return;
+
+      std::set<std::tuple<work_request::work_type,std::string,unsigned>> seen;
+      std::vector<bool> superseded(reqs.size());
+      for (size_t i = reqs.size(); i-- > 0; )
+        if (auto key = supersede_key(reqs[i]); key && ! seen.insert(std::move(*key)).second)
+          superseded[i] = true;
+
+      std::deque<work_request> res;
+      for (size_t i = 0; i < reqs.size(); ++i)
+        if (! superseded[i])
+          res.emplace_back(std::move(reqs[i]));
+      reqs = std::move(res);
+    }
+
+  } // anonymous namespace
+
+
+  // Called by the obsws thread only.
+  void info::enqueue(work_request&& req)
   {
-    std::unique_lock<std::mutex> m(worker_m);
-    worker_cv.wait(m, [this]{ return ! worker_queue.empty(); });
-    auto req = std::move(worker_queue.front());
-    worker_queue.pop();
-    return req;
+    if (! worker_queue.push(std::move(req)))
+      resync = true;
+    wake_worker();
   }
 
 
-  std::optional<work_request> info::get_request(const std::chrono::time_point<timeout_clock>& to)
+  void info::wake_worker()
   {
-    std::unique_lock<std::mutex> m(worker_m);
-    while (worker_queue.empty())
-      if (worker_cv.wait_until(m, to) == std::cv_status::timeout) {
-        if (worker_queue.empty())
-          return std::nullopt;
+    uint64_t one = 1;
+    auto _ = write(worker_efd, &one, sizeof(one));
+    (void) _;
+  }
+
+
+  work_request info::get_request()
+  {
+    // Everything posted so far is taken at once so that superseded requests are not
+    // handled.  Bursts of events arrive while the worker is busy redrawing.
+    work_request req;
+    while (worker_pending.empty()) {
+      if (terminate)
+        return work_request();
+
+      if (resync.exchange(false)) {
+        // Events were lost, the ones still queued are of no use.
+        while (worker_queue.pop(req))
+          ;
+        std::cerr << "OBS event queue overflow, reading the session state again\n";
+        worker_pending.push_back(work_request::make<work_request::work_type::new_session>());
         break;
       }
-    auto req = std::move(worker_queue.front());
-    worker_queue.pop();
+
+      while (worker_queue.pop(req))
+        worker_pending.emplace_back(std::move(req));
+      while (key_queue.pop(req))
+        worker_pending.emplace_back(std::move(req));
+      if (ftb_frame_due.exchange(false))
+        worker_pending.push_back(work_request::make<work_request::work_type::ftb_frame>());
+      if (buttons_due.exchange(false))
+        worker_pending.push_back(work_request::make<work_request::work_type::buttons>());
+
+      if (worker_pending.empty()) {
+        // The counter is not zero if anything was posted since the queue was checked.
+        uint64_t count;
+        auto _ = read(worker_efd, &count, sizeof(count));
+        (void) _;
+      }
+    }
+
+    if (auto hw = worker_queue.high_water(); hw > reported_high_water && hw >= worker_queue_size / 2) {
+      std::cerr << "OBS event queue high-water mark " << hw << " of " << worker_queue_size << '\n';
+      reported_high_water = hw;
+    }
+
+    coalesce(worker_pending);
+
+    req = std::move(worker_pending.front());
+    worker_pending.pop_front();
     return req;
   }
 
 
+  void info::start_ftb()
+  {
+    ftb.start();
+    auto id = timers.start(ftb_frame_time, [this]{ ftb_frame_due = true; wake_worker(); });
+    if (auto old = ftb_timer.exchange(id))
+      timers.stop(old);
+  }
+
+
+  void info::stop_ftb()
+  {
+    ftb.stop();
+    if (auto old = ftb_timer.exchange(0))
+      timers.stop(old);
+  }
+
+
   void info::button_update(button_class cb)
   {
-    if ((cb & button_class::live) != button_class::none)
-      for (auto& b : scene_live_buttons)
-        std::get<1>(b).show_icon();
+    std::vector<button*> batch;
+    auto add = [&batch](auto& container) {
+      for (auto& b : container)
+        if constexpr (requires { b.second; })
+          batch.emplace_back(&b.second);
+        else
+          batch.emplace_back(&b);
+    };
 
+    if ((cb & button_class::live) != button_class::none)
+      add(scene_live_buttons);
     if ((cb & button_class::preview) != button_class::none)
-      for (auto& b : scene_preview_buttons)
-        std::get<1>(b).show_icon();
-
+      add(scene_preview_buttons);
     if ((cb & button_class::cut) != button_class::none)
-      for (auto& b : cut_buttons)
-        b.show_icon();
-
+      add(cut_buttons);
     if ((cb & button_class::auto_) != button_class::none)
-      for (auto& b : auto_buttons)
-        b.show_icon();
-
+      add(auto_buttons);
     if ((cb & button_class::ftb) != button_class::none)
-      for (auto& b : ftb_buttons)
-        b.show_icon();
-
+      add(ftb_buttons);
     if ((cb & button_class::transition) != button_class::none)
-      for (auto& b : transition_buttons)
-        std::get<1>(b).show_icon();
-
+      add(transition_buttons);
     if ((cb & button_class::record) != button_class::none)
-      for (auto& b : record_buttons)
-        b.show_icon();
-
+      add(record_buttons);
     if ((cb & button_class::sources) != button_class::none)
-      for (auto& b : source_buttons)
-        std::get<1>(b).show_icon();
+      add(source_buttons);
+
+    // Render all images first, in parallel if possible, then send them to the device in
+    // key order.
+    if (batch.size() > 1 && renderers.size() > 1) {
+      std::vector<render_pool::job_type> jobs;
+      for (auto b : batch)
+        jobs.emplace_back([b](render_pool::context& ctx){ b->prepare(&ctx); });
+      renderers.run(std::move(jobs));
+    } else
+      for (auto b : batch)
+        b->prepare(nullptr);
+
+    std::ranges::sort(batch, {}, [](const button* b){ return std::tuple(b->page, b->row, b->column); });
+    for (auto b : batch)
+      b->upload();
   }
 
 
+
   void info::worker_thread()
   {
-    static constexpr auto cycle_time = 75ms;
-
     get_session_data();
 
-    auto now = timeout_clock::now();
-    auto to = now + cycle_time;
-
     Json::Value batch;
     while (! terminate) {
-      work_request req;
-      if (ftb.active()) {
-        auto oreq = get_request(to);
-
-        now = timeout_clock::now();
-        if (now >= to) {
-          ++ftb;
-          button_update(button_class::ftb);
-          to += cycle_time;
-          if (to < now)
-            to = now + cycle_time;
-        } else
-          // We are likely in a middle of a cycle, redraw the inactive icon
-          button_update(button_class::ftb);
-
-        if (! oreq)
-          continue;
-
-        req = std::move(*oreq);
-      } else
-        req = get_request();
+      auto req = get_request();
+      // All key updates caused by the request are sent to the device together.
+      key_frame frame;
 
       Json::Value d;
-      switch(req.type) {
+      switch(req.type()) {
       case work_request::work_type::none:
         break;
       case work_request::work_type::new_session:
@@ -472,46 +735,33 @@ namespace obs {
       case work_request::work_type::scene:
         {
           if (ftb.active())
-            ftb.stop();
+            stop_ftb();
 
           auto old_nr = get_current_scene().nr;
 
-          current_scene = req.names[0];
-          auto& new_live = get_current_scene();
+          current_scene = std::move(req.get<work_request::work_type::scene>().name);
+          auto new_nr = get_current_scene().nr;
 
-          if (old_nr != new_live.nr)
-            for (auto& p : scene_live_buttons)
-              if (p.second.nr == old_nr || p.second.nr == new_live.nr)
-                p.second.show_icon();
+          if (old_nr != new_nr) {
+            show_icons(scene_live_buttons, old_nr);
+            show_icons(scene_live_buttons, new_nr);
+          }
 
           if (! studio_mode) {
-            d["requestType"] = "GetSceneItemList";
-            d["requestData"]["sceneName"] = current_scene;
-
-            if (auto res = obsws::call(d); res["requestStatus"]["result"].asBool()) {
-              current_sources.clear();
-              for (const auto& s : res["responseData"]["sceneItems"]) {
-                auto idx = s["sceneItemIndex"].asUInt();
-                if (current_sources.size() <= idx)
-                  current_sources.resize(idx + 1);
-                current_sources[idx].uuid = s["sourceUuid"].asString();
-                current_sources[idx].name = s["sourceName"].asString();
-                current_sources[idx].id = s["sceneItemId"].asUInt();
-                current_sources[idx].enabled = s["sceneItemEnabled"].asBool();
-              }
-            }
+            if (auto s = scenes.find(current_scene))
+              (void) load_items(*s);
             button_update(button_class::sources);
           }
         }
         break;
       case work_request::work_type::visible:
-        assert(req.names.size() == 2);
-        if (req.names[0] == (studio_mode ? current_preview : current_scene)) {
-          auto it = std::ranges::find_if(current_sources, [id=req.nr](const auto& s) { return s.id == id; });
-          assert(it != current_sources.end());
-          it->enabled = req.names[1] == "true";
-          button_update(button_class::sources);
-          break;
+        if (auto& r = req.get<work_request::work_type::visible>(); auto items = known_items(r.scene)) {
+          auto idx = items->find(r.id);
+          if (idx) {
+            (*items)[*idx].enabled = r.enabled;
+            if (r.scene == shown_scene())
+              show_icons(source_buttons, 1 + *idx);
+          }
         }
         break;
       case work_request::work_type::preview:
@@ -520,61 +770,38 @@ namespace obs {
 
           auto old_nr = get_current_preview().nr;
 
-          current_preview = req.names[0];
-          auto& new_preview = get_current_preview();
-
-          if (old_nr != new_preview.nr) {
-            d["requestType"] = "GetSceneItemList";
-            d["requestData"]["sceneName"] = current_preview;
-
-            if (auto res = obsws::call(d); res["requestStatus"]["result"].asBool()) {
-              current_sources.clear();
-              for (const auto& s : res["responseData"]["sceneItems"]) {
-                auto idx = s["sceneItemIndex"].asUInt();
-                if (current_sources.size() <= idx)
-                  current_sources.resize(idx + 1);
-                current_sources[idx].uuid = s["sourceUuid"].asString();
-                current_sources[idx].name = s["sourceName"].asString();
-                current_sources[idx].id = s["sceneItemId"].asUInt();
-                current_sources[idx].enabled = s["sceneItemEnabled"].asBool();
-              }
-            }
+          current_preview = std::move(req.get<work_request::work_type::preview>().name);
+          if (old_nr != get_current_preview().nr) {
+            if (auto s = scenes.find(current_preview))
+              (void) load_items(*s);
             button_update(button_class::sources | button_class::preview);
           }
         }
         break;
       case work_request::work_type::transition:
         if (! ignore_next_transition_change) {
-          auto& old_transition = get_current_transition();
-          current_transition = req.names[0];
-          auto& new_transition = get_current_transition();
-          for (auto& p : transition_buttons)
-            if (p.second.nr == old_transition.nr || p.second.nr == new_transition.nr)
-              p.second.show_icon();
+          auto old_nr = get_current_transition().nr;
+          current_transition = std::move(req.get<work_request::work_type::transition>().name);
+          auto new_nr = get_current_transition().nr;
+          show_icons(transition_buttons, old_nr);
+          if (new_nr != old_nr)
+            show_icons(transition_buttons, new_nr);
         }
         break;
       case work_request::work_type::new_scene:
         {
-          auto& name = req.names[0];
+          auto& name = req.get<work_request::work_type::new_scene>().name;
           unsigned nr = 1 + scenes.size();
-          scenes.emplace(std::piecewise_construct, std::forward_as_tuple(name), std::forward_as_tuple(nr, name));
-          auto rlive = scene_live_buttons.equal_range(nr);
-          for (auto it = rlive.first; it != rlive.second; ++it)
-            it->second.show_icon();
-          auto rpreview = scene_preview_buttons.equal_range(nr);
-          for (auto it = rpreview.first; it != rpreview.second; ++it)
-            it->second.show_icon();
+          if (scenes.append(name) == nullptr)
+            break;
+          show_icons(scene_live_buttons, nr);
+          show_icons(scene_preview_buttons, nr);
         }
         break;
       case work_request::work_type::delete_scene:
         {
-          auto& name = req.names[0];
-          if (auto it = scenes.find(name); it != scenes.end()) {
-            auto nr = it->second.nr;
-            scenes.erase(it);
-            for (auto& s : scenes)
-              if (s.second.nr >= nr)
-                --s.second.nr;
+          auto& name = req.get<work_request::work_type::delete_scene>().name;
+          if (auto nr = scenes.erase(name); nr != 0) {
             for (auto& b : scene_live_buttons)
               if (b.second.nr >= nr)
                 b.second.show_icon();
@@ -585,26 +812,21 @@ namespace obs {
         }
         break;
       case work_request::work_type::new_source:
-        if (req.names[1] == (studio_mode ? current_preview : current_scene)) {
-          current_sources.emplace(current_sources.begin() + req.nr, std::move(req.names[3]), std::move(req.names[2]), unsigned(std::atoi(req.names[0].c_str())), true);
-          button_update(button_class::sources);
+        if (auto& r = req.get<work_request::work_type::new_source>(); auto items = known_items(r.scene)) {
+          if (items->insert(r.index, { std::move(r.uuid), std::move(r.name), r.id, true }) && r.scene == shown_scene())
+            button_update(button_class::sources);
         }
         break;
       case work_request::work_type::remove_source:
-        if (req.names[0] == (studio_mode ? current_preview : current_scene)) {
-          for (auto it = current_sources.begin(); it != current_sources.end(); ++it)
-            if (it->uuid == req.names[1]) {
-              current_sources.erase(it);
-              button_update(button_class::sources);
-              break;
-            }
-        }
+        if (auto& r = req.get<work_request::work_type::remove_source>(); auto items = known_items(r.scene))
+          if (items->erase(r.id) && r.scene == shown_scene())
+            button_update(button_class::sources);
         break;
       case work_request::work_type::recording:
-        is_recording = req.nr != 0;
+        is_recording = req.get<work_request::work_type::recording>().active;
         button_update(button_class::record);
         if (! is_recording && ! open.empty()) {
-          std::filesystem::path fname(req.names[0]);
+          std::filesystem::path fname(req.get<work_request::work_type::recording>().path);
           static const char pattern[] = "%URL%";
           auto cmd = open;
           if (auto n = cmd.find(pattern); n != std::string::npos)
@@ -614,17 +836,26 @@ namespace obs {
         }
         break;
       case work_request::work_type::streaming:
-        is_streaming = req.nr != 0;
+        is_streaming = req.get<work_request::work_type::streaming>().on;
         button_update(button_class::record);
         break;
       case work_request::work_type::virtualcam:
-        provide_virtualcam = req.nr != 0;
+        provide_virtualcam = req.get<work_request::work_type::virtualcam>().on;
         button_update(button_class::record);
         break;
       case work_request::work_type::sceneschanged:
-        scenes.clear();
-        for (auto& s : req.names)
-          scenes.emplace(std::piecewise_construct, std::forward_as_tuple(s), std::forward_as_tuple(1 + scenes.size(), s));
+        {
+          // The items of the scenes which remain are still valid.
+          auto& names = req.get<work_request::work_type::sceneschanged>().names;
+          std::vector<std::optional<scene_items>> items(names.size());
+          for (size_t n = 0; n < names.size(); ++n)
+            if (auto s = scenes.find(names[n]))
+              items[n] = std::move(s->items);
+          scenes.clear();
+          for (size_t n = 0; n < names.size(); ++n)
+            if (auto s = scenes.append(names[n]))
+              s->items = std::move(items[n]);
+        }
         batch.clear();
         d["requestType"] = "GetCurrentProgramScene";
         batch["requests"].append(d);
@@ -641,7 +872,7 @@ namespace obs {
         button_update(button_class::live | button_class::preview);
         break;
       case work_request::work_type::studiomode:
-        studio_mode = req.nr;
+        studio_mode = req.get<work_request::work_type::studiomode>().on;
         d["requestType"] = "GetSceneList";
         {
           auto res = obsws::call(d);
@@ -652,39 +883,26 @@ namespace obs {
             current_preview.clear();
           button_update(button_class::live | button_class::preview);
         }
-        d["requestType"] = "GetSceneItemList";
-        d["requestData"]["sceneName"] = studio_mode ? current_preview : current_scene;
-
-        if (auto res = obsws::call(d); res["requestStatus"]["result"].asBool()) {
-          current_sources.clear();
-          for (const auto& s : res["responseData"]["sceneItems"]) {
-            auto idx = s["sceneItemIndex"].asUInt();
-            if (current_sources.size() <= idx)
-              current_sources.resize(idx + 1);
-            current_sources[idx].uuid = s["sourceUuid"].asString();
-            current_sources[idx].name = s["sourceName"].asString();
-            current_sources[idx].id = s["sceneItemId"].asUInt();
-            current_sources[idx].enabled = s["sceneItemEnabled"].asBool();
-          }
-        }
+        if (auto s = scenes.find(shown_scene()))
+          (void) load_items(*s);
         button_update(button_class::all ^ button_class::live ^ button_class::record ^ button_class::transition);
         break;
       case work_request::work_type::sourcename:
-        assert(req.names.size() == 3);
-        for (size_t idx = 0; idx < current_sources.size(); ++idx)
-          if (current_sources[idx].uuid == req.names[0]) {
-            assert(current_sources[idx].name == req.names[1]);
-            current_sources[idx].name = std::move(req.names[2]);
-            for (auto& e : source_buttons)
-              if (e.second.nr == 1 + idx) {
-                e.second.show_icon();
-                break;
+        {
+          // Inputs are not part of a scene, all scenes can show them.
+          auto& r = req.get<work_request::work_type::sourcename>();
+          for (unsigned nr = 1; nr <= scenes.size(); ++nr)
+            if (auto s = scenes.find(nr); s->items)
+              for (auto idx : s->items->find(r.uuid)) {
+                assert((*s->items)[idx].name == r.old_name || (*s->items)[idx].name == r.name);
+                (*s->items)[idx].name = r.name;
+                if (s->name == shown_scene())
+                  show_icons(source_buttons, 1 + idx);
               }
-            break;
-          }
+        }
         break;
       case work_request::work_type::transitionend:
-        if (ignore_next_transition_change && req.names[0] == "Cut") {
+        if (ignore_next_transition_change && req.get<work_request::work_type::transitionend>().name == "Cut") {
           ignore_next_transition_change = false;
           batch.clear();
           d["requestType"] = "SetCurrentSceneTransition";
@@ -695,7 +913,7 @@ namespace obs {
           d["requestData"]["transitionDuration"] = current_duration_ms;
           batch["requests"].append(d);
           obsws::batch(batch);
-        } else if (ignore_next_transition_change && req.names[0] == "Fade") {
+        } else if (ignore_next_transition_change && req.get<work_request::work_type::transitionend>().name == "Fade") {
           ignore_next_transition_change = false;
           batch.clear();
           d["requestType"] = "SetCurrentSceneTransition";
@@ -720,36 +938,39 @@ namespace obs {
         break;
       case work_request::work_type::duration:
         if (! ignore_next_transition_change) {
-          current_duration_ms = req.nr;
+          current_duration_ms = req.get<work_request::work_type::duration>().ms;
           for (auto& b : auto_buttons)
             b.show_icon();
         }
         break;
       case work_request::work_type::sourceorder:
-        if ((studio_mode && req.names[0] == current_preview) || (! studio_mode && req.names[0] == current_scene)) {
-          req.names.erase(req.names.begin());
-          assert(req.names.size() > 2);
-          assert(req.names.size() % 2 == 0);
-          std::vector<size_t> new_order;
-          for (size_t i = 0; i < req.names.size(); i += 2) {
-            unsigned id = std::atoi(req.names[i].c_str());
-            unsigned idx = std::atoi(req.names[i + 1].c_str());
-            size_t j;
-            for (j = 0; j < current_sources.size(); ++j)
-              if (current_sources[j].id == id)
-                break;
-            assert(j < current_sources.size());
-            if (idx >= new_order.size())
-              new_order.resize(idx + 1);
-            new_order[idx] = j;
-          }
-          decltype(current_sources) new_sources;
-          for (auto idx : new_order)
-            new_sources.emplace_back(std::move(current_sources[idx]));
-          current_sources = std::move(new_sources);
-          button_update(button_class::sources);
+        if (auto& r = req.get<work_request::work_type::sourceorder>(); auto items = known_items(r.scene)) {
+          items->reorder(r.items);
+          if (r.scene == shown_scene())
+            button_update(button_class::sources);
+        }
+        break;
+      case work_request::work_type::ftb_frame:
+        // Frames requested before the animation was stopped are ignored.
+        if (ftb.active()) {
+          ++ftb;
+          button_update(button_class::ftb);
         }
         break;
+      case work_request::work_type::toggle_source:
+        if (auto nr = req.get<work_request::work_type::toggle_source>().nr; connected && (! ftb.active() || studio_mode))
+          if (auto& items = shown_items(); nr <= items.size()) {
+            d["requestType"] = "SetSceneItemEnabled";
+            d["requestData"]["sceneName"] = shown_scene();
+            d["requestData"]["sceneItemId"] = items[nr - 1].id;
+            d["requestData"]["sceneItemEnabled"] = ! items[nr - 1].enabled;
+            obsws::emit(d);
+
+            // The event OBS sends confirms the change.
+            items[nr - 1].enabled = ! items[nr - 1].enabled;
+            show_icons(source_buttons, nr);
+          }
+        break;
       }
     }
   }
@@ -757,6 +978,12 @@ namespace obs {
 
   void info::get_session_data()
   {
+    // Only the first session is part of the startup.
+    static std::atomic_flag first_session;
+    std::optional<startup::scope> timing;
+    if (! first_session.test_and_set())
+      timing.emplace("OBS session data");
+
     Json::Value d;
     d["requestType"] = "GetVersion";
     auto resp = obsws::call(d);
@@ -814,7 +1041,7 @@ namespace obs {
         if (name == "Black")
           has_Black = true;
         else
-          scenes.emplace(std::piecewise_construct, std::forward_as_tuple(name), std::forward_as_tuple(1 + scenes.size(), name));
+          scenes.append(name);
       }
 
       if (! has_Black) {
@@ -836,7 +1063,7 @@ namespace obs {
     if (transitionlist["requestStatus"]["result"].asBool())
       for (auto& t : transitionlist["transitions"])
         if (auto name = t["transitionName"].asString(); name != "Cut")
-          transitions.emplace(std::piecewise_construct, std::forward_as_tuple(name), std::forward_as_tuple(1 + transitions.size(), name));
+          transitions.append(name);
 
     auto& ctransition = resp["results"][++idx];
     if (ctransition["requestStatus"]["result"].asBool()) {
@@ -856,37 +1083,52 @@ namespace obs {
     if (virtualcamstatus["requestStatus"]["result"].asBool())
       provide_virtualcam = virtualcamstatus["outputActive"].asBool();
 
-    d.clear();
-    d["requestType"] = "GetSceneItemList";
-    d["requestData"]["sceneName"] = studio_mode ? current_preview : current_scene;
-    if (auto res = obsws::call(d); res["requestStatus"]["result"].asBool()) {
-      current_sources.clear();
-      for (const auto& s : res["responseData"]["sceneItems"]) {
-        auto idx = s["sceneItemIndex"].asUInt();
-        if (current_sources.size() <= idx)
-          current_sources.resize(idx + 1);
-        current_sources[idx].uuid = s["sourceUuid"].asString();
-        current_sources[idx].name = s["sourceName"].asString();
-        current_sources[idx].id = s["sceneItemId"].asUInt();
-        current_sources[idx].enabled = s["sceneItemEnabled"].asBool();
-      }
-    }
-
     connected = true;
 
+    // The source keys show the items of this scene, they are needed for the first paint.
+    if (auto s = scenes.find(shown_scene()))
+      (void) load_items(*s);
+
+    if (prerender)
+      prerender_labels(button_class::all);
+
     button_update(button_class::all);
+
+    // The items of the other scenes are requested in one batch after the keys are painted.
+    // The obsws client does not allow calls from more than one thread, the worker waits.
+    std::vector<unsigned> requested;
+    batch.clear();
+    for (unsigned nr = 1; nr <= scenes.size(); ++nr)
+      if (auto s = scenes.find(nr); ! s->items) {
+        d.clear();
+        d["requestType"] = "GetSceneItemList";
+        d["requestData"]["sceneName"] = s->name;
+        batch["requests"].append(d);
+        requested.push_back(nr);
+      }
+    if (! requested.empty()) {
+      key_frame::flush();
+
+      // The results are in the order of the requests.  Scenes without a result are
+      // requested again when they are shown.  Events for the scenes which arrived in the
+      // meantime are handled afterwards; they may already be reflected in the lists.
+      resp = obsws::batch(batch);
+      auto& results = resp["results"];
+      for (Json::ArrayIndex n = 0; n < results.size() && n < requested.size(); ++n)
+        if (results[n]["requestStatus"]["result"].asBool())
+          scenes.find(requested[n])->items.emplace().assign(results[n]["responseData"]["sceneItems"]);
+    }
   }
 
 
   void info::add_scene(unsigned idx, const char* name)
   {
     assert(! scenes.contains(name));
-    auto sname = std::string(name);
-    scenes.emplace(std::piecewise_construct, std::forward_as_tuple(name), std::forward_as_tuple(idx, name));
+    scenes.insert(idx, name);
   }
 
 
-  button* info::parse_key(set_key_image_cb setkey_image, set_key_handle_cb setkey_handle, unsigned page, unsigned row, unsigned column, const libconfig::Setting& config)
+  button* info::parse_key(set_key_buffer_cb setkey_buffer, set_key_handle_cb setkey_handle, unsigned page, unsigned row, unsigned column, const libconfig::Setting& config)
   {
     if (! config.exists("function"))
       return nullptr;
@@ -894,8 +1136,8 @@ namespace obs {
     auto function = std::string(config["function"]);
     std::string icon1name;
     std::string icon2name;
-    int icon1;
-    int icon2;
+    lazy_icon icon1;
+    lazy_icon icon2;
     config.lookupValue("icon1", icon1name);
     if (config.exists("icon2"))
       config.lookupValue("icon2", icon2name);
@@ -913,7 +1155,7 @@ namespace obs {
       else
       	font = obsfont;
       unsigned nr = 1u + scene_live_buttons.size();
-      return &scene_live_buttons.emplace(nr, scene_button(nr, setkey_image, setkey_handle, this, page, row, column, find_image(icon1name), find_image(icon2name), keyop_type::live_scene, ftobj, font))->second;
+      return &scene_live_buttons.emplace(nr, scene_button(nr, setkey_buffer, setkey_handle, this, page, row, column, icon1name, icon2name, keyop_type::live_scene, ftobj, font))->second;
     } else if (function == "scene-preview") {
       if (icon1name.empty()) {
         icon1name = "scene_preview.png";
@@ -926,12 +1168,12 @@ namespace obs {
       else
       	font = obsfont;
       unsigned nr = 1u + scene_preview_buttons.size();
-      return &scene_preview_buttons.emplace(nr, scene_button(nr, setkey_image, setkey_handle, this, page, row, column, find_image(icon1name), find_image(icon2name), keyop_type::preview_scene, ftobj, font))->second;
+      return &scene_preview_buttons.emplace(nr, scene_button(nr, setkey_buffer, setkey_handle, this, page, row, column, icon1name, icon2name, keyop_type::preview_scene, ftobj, font))->second;
     } else if (function == "scene-cut") {
       if (icon1name.empty())
         icon1name = "cut.png";
-      icon1 = register_image(find_image(icon1name));
-      return &cut_buttons.emplace_back(0, setkey_image, setkey_handle, this, page, row, column, icon1, icon1, keyop_type::cut);
+      icon1 = make_icon(icon1name);
+      return &cut_buttons.emplace_back(0, setkey_buffer, setkey_handle, this, page, row, column, icon1, icon1, keyop_type::cut);
     } else if (function == "scene-auto") {
       if (icon1name.empty())
         icon1name = "auto.png";
@@ -958,12 +1200,12 @@ namespace obs {
           }
         }
       }
-      return &auto_buttons.emplace_back(0, setkey_image, setkey_handle, this, page, row, column, find_image(icon1name), keyop_type::auto_rate, ftobj, font, color, std::move(center), current_duration_ms);
+      return &auto_buttons.emplace_back(0, setkey_buffer, setkey_handle, this, page, row, column, find_image(icon1name), keyop_type::auto_rate, ftobj, font, color, std::move(center), current_duration_ms);
     } else if (function == "scene-ftb") {
       if (icon1name.empty())
         icon1name = "ftb.png";
-      icon1 = register_image(find_image(icon1name));
-      return &ftb_buttons.emplace_back(0, setkey_image, setkey_handle, this, page, row, column, icon1, icon1, keyop_type::ftb);
+      icon1 = make_icon(icon1name);
+      return &ftb_buttons.emplace_back(0, setkey_buffer, setkey_handle, this, page, row, column, icon1, icon1, keyop_type::ftb);
     } else if (function == "transition") {
       if (icon1name.empty()) {
         icon1name = "transition.png";
@@ -976,7 +1218,7 @@ namespace obs {
       else
       	font = obsfont;
       unsigned nr = 1u + transition_buttons.size();
-      return &transition_buttons.emplace(nr, transition_button(nr, setkey_image, setkey_handle, this, page, row, column, find_image(icon1name), find_image(icon2name), keyop_type::transition, ftobj, font))->second;
+      return &transition_buttons.emplace(nr, transition_button(nr, setkey_buffer, setkey_handle, this, page, row, column, icon1name, icon2name, keyop_type::transition, ftobj, font))->second;
     } else if (function == "source") {
       if (icon1name.empty()) {
         icon1name = "source.png";
@@ -989,65 +1231,97 @@ namespace obs {
       else
         font = obsfont;
       unsigned nr = 1u + source_buttons.size();
-      icon1 = register_image(find_image(icon1name));
-      return &source_buttons.emplace(nr, source_button(nr, setkey_image, setkey_handle, this, page, row, column, find_image(icon1name), find_image(icon2name), keyop_type::source, ftobj, font))->second;
+      return &source_buttons.emplace(nr, source_button(nr, setkey_buffer, setkey_handle, this, page, row, column, icon1name, icon2name, keyop_type::source, ftobj, font))->second;
     } else if (function == "toggle-record") {
       if (icon1name.empty()) {
         icon1name = "record.png";
         if (icon2name.empty())
           icon2name = "record_off.png";
       }
-      icon1 = register_image(find_image(icon1name));
+      icon1 = make_icon(icon1name);
       if (icon1name == icon2name)
         icon2 = icon1;
       else
-        icon2 = register_image(find_image(icon2name));
-      return &record_buttons.emplace_back(0, setkey_image, setkey_handle, this, page, row, column, icon1, icon2, keyop_type::record);
+        icon2 = make_icon(icon2name);
+      return &record_buttons.emplace_back(0, setkey_buffer, setkey_handle, this, page, row, column, icon1, icon2, keyop_type::record);
     } else if (function == "toggle-stream") {
       if (icon1name.empty()) {
         icon1name = "stream.png";
         if (icon2name.empty())
           icon2name = "stream_off.png";
       }
-      icon1 = register_image(find_image(icon1name));
+      icon1 = make_icon(icon1name);
       if (icon1name == icon2name)
         icon2 = icon1;
       else
-        icon2 = register_image(find_image(icon2name));
-      return &record_buttons.emplace_back(0, setkey_image, setkey_handle, this, page, row, column, icon1, icon2, keyop_type::stream);
+        icon2 = make_icon(icon2name);
+      return &record_buttons.emplace_back(0, setkey_buffer, setkey_handle, this, page, row, column, icon1, icon2, keyop_type::stream);
     } else if (function == "toggle-virtual-cam") {
       if (icon1name.empty()) {
         icon1name = "virtualcam.png";
         if (icon2name.empty())
           icon2name = "virtualcam_off.png";
       }
-      icon1 = register_image(find_image(icon1name));
+      icon1 = make_icon(icon1name);
       if (icon1name == icon2name)
         icon2 = icon1;
       else
-        icon2 = register_image(find_image(icon2name));
-      return &record_buttons.emplace_back(0, setkey_image, setkey_handle, this, page, row, column, icon1, icon2, keyop_type::virtualcam);
+        icon2 = make_icon(icon2name);
+      return &record_buttons.emplace_back(0, setkey_buffer, setkey_handle, this, page, row, column, icon1, icon2, keyop_type::virtualcam);
     }
 
     return nullptr;
   }
 
 
-  scene& info::get_current_scene()
+  const scene& info::get_current_scene() const
+  {
+    auto s = scenes.find((! studio_mode && ftb.active()) ? saved_scene : current_scene);
+    return s != nullptr ? *s : no_scene;
+  }
+
+
+  const scene& info::get_current_preview() const
+  {
+    auto s = scenes.find(current_preview);
+    return s != nullptr ? *s : no_scene;
+  }
+
+
+  const transition& info::get_current_transition() const
+  {
+    auto t = transitions.find(current_transition);
+    return t != nullptr ? *t : no_transition;
+  }
+
+
+  scene_items& info::shown_items()
   {
-    return scenes[(! studio_mode && ftb.active()) ? saved_scene : current_scene];
+    auto s = scenes.find(shown_scene());
+    return s != nullptr && s->items ? *s->items : no_items;
   }
 
 
-  scene& info::get_current_preview()
+  scene_items* info::known_items(const std::string& name)
   {
-    return scenes[current_preview];
+    auto s = scenes.find(name);
+    return s != nullptr && s->items ? &*s->items : nullptr;
   }
 
 
-  transition& info::get_current_transition()
+  // Only the first use of a scene requires a round trip, afterwards the items are kept up
+  // to date by the events.
+  scene_items& info::load_items(scene& s)
   {
-    return transitions[current_transition];
+    if (! s.items) {
+      key_frame::flush();
+      Json::Value d;
+      d["requestType"] = "GetSceneItemList";
+      d["requestData"]["sceneName"] = s.name;
+      if (auto res = obsws::call(d); res["requestStatus"]["result"].asBool())
+        s.items.emplace().assign(res["responseData"]["sceneItems"]);
+    }
+    return s.items ? *s.items : no_items;
   }
 
 
@@ -1058,107 +1332,20 @@ namespace obs {
     if (! connected)
       return;
 
-    std::vector<std::string> vs;
-    decltype(work_request::nr) nr = 0;
-    work_request::work_type type(work_request::work_type::none);
-
-
-    auto event_type = val["eventType"];
-    if (event_type == "CurrentProgramSceneChanged") {
-      vs.emplace_back(val["eventData"]["sceneName"].asString());
-      type = work_request::work_type::scene;
-    } else if (event_type == "CurrentPreviewSceneChanged") {
-      vs.emplace_back(val["eventData"]["sceneName"].asString());
-      type = work_request::work_type::preview;
-    } else if (event_type == "CurrentSceneTransitionChanged") {
-      if (! handle_next_transition_change.test_and_set())
-        return;
-
-      vs.emplace_back(val["eventData"]["transitionName"].asString());
-      type = work_request::work_type::transition;
-    } else if (event_type == "ExitStarted")
+    std::string_view event_type = val["eventType"].asCString();
+    if (event_type == "ExitStarted") {
       connection_update(false);
-    else if (event_type == "CurrentSceneTransitionDurationChanged") {
-      nr = val["eventData"]["transitionDuration"].asUInt();
-      type = work_request::work_type::duration;
-    } else if (event_type == "SceneItemCreated") {
-      vs.emplace_back(val["eventData"]["sceneItemId"].asString());
-      vs.emplace_back(val["eventData"]["sceneName"].asString());
-      vs.emplace_back(val["eventData"]["sourceName"].asString());
-      vs.emplace_back(val["eventData"]["sourceUuid"].asString());
-      nr = val["eventData"]["sceneItemIndex"].asUInt();
-      type = work_request::work_type::new_source;
-    } else if (event_type == "SceneItemRemoved") {
-      vs.emplace_back(val["eventData"]["sceneName"].asString());
-      vs.emplace_back(val["eventData"]["sourceUuid"].asString());
-      type = work_request::work_type::remove_source;
-    } else if (event_type == "RecordStateChanged") {
-      vs.emplace_back(val["eventData"]["outputPath"].asString());
-      nr = val["eventData"]["outputActive"].asBool();
-      type = work_request::work_type::recording;
-    } else if (event_type == "StreamStateChanged") {
-      nr = val["eventData"]["outputActive"].asBool();
-      type = work_request::work_type::streaming;
-    } else if (event_type == "VirtualcamStateChanged") {
-      nr = val["eventData"]["outputActive"].asBool();
-      type = work_request::work_type::virtualcam;
-    } else if (event_type == "SceneListChanged") {
-      for (auto& s : val["eventData"]["scenes"])
-        if (s["sceneName"] != "Black")
-          vs.emplace_back(s["sceneName"].asString());
-      type = work_request::work_type::sceneschanged;
-    } else if (event_type == "StudioModeStateChanged") {
-      nr = val["eventData"]["studioModeEnabled"].asBool();
-      type = work_request::work_type::studiomode;
-    } else if (event_type == "SceneItemEnableStateChanged") {
-      vs.emplace_back(val["eventData"]["sceneName"].asString());
-      vs.emplace_back(val["eventData"]["sceneItemEnabled"].asBool() ? "true" : "false");
-      nr = val["eventData"]["sceneItemId"].asUInt();
-      type = work_request::work_type::visible;
-    } else if (event_type == "InputNameChanged") {
-      vs.emplace_back(val["eventData"]["inputUuid"].asString());
-      vs.emplace_back(val["eventData"]["oldInputName"].asString());
-      vs.emplace_back(val["eventData"]["inputName"].asString());
-      type = work_request::work_type::sourcename;
-    } else if (event_type == "SceneTransitionEnded") {
-      vs.emplace_back(val["eventData"]["transitionName"].asString());
-      type = work_request::work_type::transitionend;
-    } else if (event_type == "SceneItemListReindexed") {
-      vs.emplace_back(val["eventData"]["sceneName"].asString());
-      for (const auto& s : val["eventData"]["sceneItems"]) {
-        vs.emplace_back(s["sceneItemId"].asString());
-        vs.emplace_back(s["sceneItemIndex"].asString());
-      }
-      type = work_request::work_type::sourceorder;
-    } else if (event_type == "SceneTransitionStarted") {
-      // Ignore
-    } else if (event_type == "SceneTransitionVideoEnded") {
-      // Ignore
-    } else if (event_type == "SceneItemSelected") {
-      // Ignore
-    } else if (event_type == "SceneNameChanged") {
-      // Ignore
-    } else if (event_type == "InputCreated") {
-      // Ignore
-    } else if (event_type == "InputRemoved") {
-      // Ignore
-    } else if (event_type == "SceneCreated") {
-      // Ignore
-    } else if (event_type == "SceneRemoved") {
-      // Ignore
-    } else if (event_type == "SceneItemTransformChanged") {
-      // Ignore
-    } else if (event_type == "InputSettingsChanged") {
-      // Ignore
-    } else {
-      if (log_unknown_events)
-        std::cout << "info::callback unhandled event = " << val << std::endl;
       return;
     }
+    if (event_type == "CurrentSceneTransitionChanged" && ! handle_next_transition_change.test_and_set())
+      return;
 
-    std::lock_guard<std::mutex> guard(worker_m);
-    worker_queue.emplace(type, nr, std::move(vs));
-    worker_cv.notify_all();
+    auto req = parse_event(val);
+    if (! req) {
+      if (log_unknown_events)
+        std::cout << "info::callback unhandled event = " << val << std::endl;
+    } else if (req->type() != work_request::work_type::none)
+      enqueue(std::move(*req));
   }
 
 
@@ -1169,14 +1356,12 @@ namespace obs {
     if (connected == connected_)
       return;
 
-    std::lock_guard<std::mutex> guard(worker_m);
     if (connected_)
-      worker_queue.emplace(work_request::work_type::new_session);
+      enqueue(work_request::make<work_request::work_type::new_session>());
     else {
       connected = false;
-      worker_queue.emplace(work_request::work_type::buttons);
+      enqueue(work_request::make<work_request::work_type::buttons>());
     }
-    worker_cv.notify_all();
   }
 
 } // namespace obs
@@ -1,13 +1,16 @@
 #ifndef _OBS_HH
 #define _OBS_HH 1
 
+#include <array>
 #include <chrono>
 #include <condition_variable>
+#include <deque>
 #include <functional>
 #include <list>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <optional>
-#include <queue>
 #include <string>
 #include <thread>
 #include <type_traits>
@@ -19,7 +22,14 @@
 #include <json/json.h>
 #include <Magick++.h>
 
+#include "buttontext.hh"
+#include "events.hh"
 #include "ftlibrary.hh"
+#include "registry.hh"
+#include "sceneitems.hh"
+#include "renderpool.hh"
+#include "spsc.hh"
+#include "timer.hh"
 
 
 namespace obs {
@@ -42,18 +52,13 @@ namespace obs {
   };
 
 
-  struct source {
-    std::string name;
-    bool enabled;
-  };
-
-
   struct scene {
     scene() = default;
-    scene(unsigned nr_, const std::string& name_) : nr(nr_), name(name_), sources() { }
+    scene(unsigned nr_, const std::string& name_) : nr(nr_), name(name_) { }
     unsigned nr = 0;
     std::string name;
-    std::vector<source> sources;
+    // Kept up to date by the scene item events once they are known.
+    std::optional<scene_items> items;
   };
 
 
@@ -65,26 +70,56 @@ namespace obs {
   };
 
 
-  using set_key_image_cb = std::function<void(unsigned,unsigned,unsigned,Magick::Image&&)>;
+  using set_key_buffer_cb = std::function<void(unsigned,unsigned,unsigned,const rgba_buffer&)>;
   using set_key_handle_cb = std::function<void(unsigned,unsigned,unsigned,int)>;
+  using register_image_cb = std::function<int(Magick::Image&&)>;
+
+
+  // Device image handle of an icon.  The image is decoded and registered with the device
+  // only when the handle is needed for the first time.  Copies share the handle.  A
+  // default-constructed object stands for no icon, -1.
+  struct lazy_icon {
+    lazy_icon() = default;
+    lazy_icon(const register_image_cb& register_image, const std::string& name);
+
+    int get() const;
+    operator int() const { return get(); }
+
+  private:
+    struct state {
+      register_image_cb register_image;
+      std::string name;
+      std::once_flag once;
+      int handle = -1;
+    };
+    std::shared_ptr<state> s;
+  };
 
 
   struct button {
-    button(unsigned nr_, set_key_image_cb setkey_image_, set_key_handle_cb set_key_handle_, info* i_, unsigned page_, unsigned row_, unsigned column_, int icon1_, int icon2_, keyop_type keyop_);
+    button(unsigned nr_, set_key_buffer_cb setkey_buffer_, set_key_handle_cb set_key_handle_, info* i_, unsigned page_, unsigned row_, unsigned column_, lazy_icon icon1_, lazy_icon icon2_, keyop_type keyop_);
 
     unsigned nr;
-    set_key_image_cb setkey_image;
+    set_key_buffer_cb setkey_buffer;
     set_key_handle_cb setkey_handle;
     info* i;
     const unsigned page;
     const unsigned row;
     const unsigned column;
-    int icon1;
-    int icon2;
+    lazy_icon icon1;
+    lazy_icon icon2;
     keyop_type keyop;
+    int pending = -1;
 
     void call();
-    virtual void show_icon();
+    // Showing the icon is split in two steps.  PREPARE determines the image and renders it
+    // if necessary, UPLOAD sends it to the device.  Given a CTX the preparation can run on
+    // a thread of the render pool and uses the faces of that thread.
+    virtual void prepare(render_pool::context* ctx);
+    virtual void upload();
+    void show_icon() { prepare(nullptr); upload(); }
+    // For threads other than the worker: the worker shows the icon.
+    void request_icon();
     bool visible() const { return true; }
     void initialize();
   };
@@ -93,15 +128,23 @@ namespace obs {
   struct auto_button : button {
     using base_type = button;
 
-    auto_button(unsigned nr_, set_key_image_cb setkey_image_, set_key_handle_cb setkey_handle_, info* i_, unsigned page_, unsigned row_, unsigned column_, Magick::Image&& icon1_, keyop_type keyop_, ftlibrary& ftobj, const std::string& font_, const std::string& color_, std::pair<double,double>&& center_, unsigned& duration_ms_)
-    : base_type(nr_, setkey_image_, setkey_handle_, i_, page_, row_, column_, -1, -1, keyop_), background(std::move(icon1_)), fontobj(ftobj, font_), duration_ms(duration_ms_), color(color_), center(std::move(center_))
+    auto_button(unsigned nr_, set_key_buffer_cb setkey_buffer_, set_key_handle_cb setkey_handle_, info* i_, unsigned page_, unsigned row_, unsigned column_, Magick::Image&& icon1_, keyop_type keyop_, ftlibrary& ftobj, const std::string& font_, const std::string& color_, std::pair<double,double>&& center_, unsigned& duration_ms_)
+    : base_type(nr_, setkey_buffer_, setkey_handle_, i_, page_, row_, column_, { }, { }, keyop_), background(icon1_), renderer(background, buffer, 0.8, 0.3), fontobj(ftobj, font_), font(font_), duration_ms(duration_ms_), color(color_), center(std::move(center_))
     {
     }
 
-    void show_icon() override ;
+    // The renderer refers to the buffers of the object.
+    auto_button(const auto_button&) = delete;
+
+    void prepare(render_pool::context* ctx) override;
+    void upload() override;
 
-    Magick::Image background;
+    const rgba_buffer background;
+    rgba_buffer buffer;
+    // Kept so that its memory is reused.
+    render_to_rgba_buffer renderer;
     ftface fontobj;
+    const std::string font;
     unsigned& duration_ms;
     Magick::Color color;
     std::pair<double,double> center;
@@ -111,98 +154,109 @@ namespace obs {
   struct scene_button : button {
     using base_type = button;
 
-    scene_button(unsigned nr_, set_key_image_cb setkey_image_, set_key_handle_cb setkey_handle_, info* i_, unsigned page_, unsigned row_, unsigned column_, Magick::Image&& icon1_, Magick::Image&& icon2_, keyop_type keyop_, ftlibrary& ftobj, const std::string& font_)
-    : base_type(nr_, setkey_image_, setkey_handle_, i_, page_, row_, column_, -1, -1, keyop_), background(std::move(icon1_)), background_off(std::move(icon2_)), fontobj(ftobj, font_)
+    scene_button(unsigned nr_, set_key_buffer_cb setkey_buffer_, set_key_handle_cb setkey_handle_, info* i_, unsigned page_, unsigned row_, unsigned column_, const std::string& icon1name_, const std::string& icon2name_, keyop_type keyop_, ftlibrary& ftobj, const std::string& font_)
+    : base_type(nr_, setkey_buffer_, setkey_handle_, i_, page_, row_, column_, { }, { }, keyop_), background_name(icon1name_), background_off_name(icon2name_), fontobj(ftobj, font_), font(font_)
     {
     }
 
-    void show_icon() override;
+    void prepare(render_pool::context* ctx) override;
 
-    Magick::Image background;
-    Magick::Image background_off;
+    // The backgrounds are only loaded when a label is rendered.
+    const std::string background_name;
+    const std::string background_off_name;
     ftface fontobj;
+    const std::string font;
   };
 
 
   struct transition_button : button {
     using base_type = button;
 
-    transition_button(unsigned nr_, set_key_image_cb setkey_image_, set_key_handle_cb setkey_handle_, info* i_, unsigned page_, unsigned row_, unsigned column_, Magick::Image&& icon1_, Magick::Image&& icon2_, keyop_type keyop_, ftlibrary& ftobj, const std::string& font_)
-    : base_type(nr_, setkey_image_, setkey_handle_, i_, page_, row_, column_, -1, -1, keyop_), background(std::move(icon1_)), background_off(std::move(icon2_)), fontobj(ftobj, std::move(font_))
+    transition_button(unsigned nr_, set_key_buffer_cb setkey_buffer_, set_key_handle_cb setkey_handle_, info* i_, unsigned page_, unsigned row_, unsigned column_, const std::string& icon1name_, const std::string& icon2name_, keyop_type keyop_, ftlibrary& ftobj, const std::string& font_)
+    : base_type(nr_, setkey_buffer_, setkey_handle_, i_, page_, row_, column_, { }, { }, keyop_), background_name(icon1name_), background_off_name(icon2name_), fontobj(ftobj, font_), font(font_)
     {
     }
 
-    void show_icon() override;
+    void prepare(render_pool::context* ctx) override;
 
-    Magick::Image background;
-    Magick::Image background_off;
+    // The backgrounds are only loaded when a label is rendered.
+    const std::string background_name;
+    const std::string background_off_name;
     ftface fontobj;
+    const std::string font;
   };
 
 
   struct source_button : button {
     using base_type = button;
 
-    source_button(unsigned nr_, set_key_image_cb setkey_image_image_, set_key_handle_cb setkey_handle_, info* i_, unsigned page_, unsigned row_, unsigned column_, Magick::Image&& icon1_, Magick::Image&& icon2_, keyop_type keyop_, ftlibrary& ftobj, const std::string& font_)
-    : base_type(nr_, setkey_image_image_, setkey_handle_, i_, page_, row_, column_, -1, -1, keyop_), background(std::move(icon1_)), background_off(std::move(icon2_)), fontobj(ftobj, std::move(font_))
+    source_button(unsigned nr_, set_key_buffer_cb setkey_buffer_, set_key_handle_cb setkey_handle_, info* i_, unsigned page_, unsigned row_, unsigned column_, const std::string& icon1name_, const std::string& icon2name_, keyop_type keyop_, ftlibrary& ftobj, const std::string& font_)
+    : base_type(nr_, setkey_buffer_, setkey_handle_, i_, page_, row_, column_, { }, { }, keyop_), background_name(icon1name_), background_off_name(icon2name_), fontobj(ftobj, font_), font(font_)
     {
     }
 
-    void show_icon() override;
+    void prepare(render_pool::context* ctx) override;
 
-    Magick::Image background;
-    Magick::Image background_off;
+    // The backgrounds are only loaded when a label is rendered.
+    const std::string background_name;
+    const std::string background_off_name;
     ftface fontobj;
+    const std::string font;
   };
 
 
-  struct work_request {
-    enum struct work_type {
-        none,
-        new_session,
-        buttons,
-        scene,
-        visible,
-        preview,
-        transition,
-        new_scene,
-        delete_scene,
-        recording,
-        streaming,
-        virtualcam,
-        sceneschanged,
-        studiomode,
-        sourcename,
-        transitionend,
-        duration,
-        sourceorder,
-        new_source,
-        remove_source,
-    } type;
-    unsigned nr = 0;
-    std::vector<std::string> names;
+  // Device image handles of rendered button labels.  The same label in the same state is
+  // shown over and over again and the handle can be reused instead of rendering the text.
+  // Renamed scenes and sources leave labels behind which are never shown again, only the
+  // most recently used ones are kept.  The device keeps the image of a dropped label; if
+  // it is rendered again the same pixels find the same registration.
+  struct label_cache {
+    struct key_type {
+      std::string text;
+      std::string font;
+      std::string background;
+      std::array<double,4> foreground;
+      std::pair<double,double> fit;
+      std::pair<double,double> pos;
+
+      auto operator<=>(const key_type&) const = default;
+    };
+
+    std::optional<int> find(const key_type& key);
+    int insert(key_type&& key, int handle);
+
+  private:
+    static constexpr size_t capacity = 1024;
+    std::mutex m;
+    using lru_type = std::list<std::pair<key_type,int>>;
+    lru_type lru;
+    std::map<key_type,lru_type::iterator> handles;
   };
 
 
   struct info {
-    using register_image_cb = std::function<int(Magick::Image&&)>;
-
     info(const libconfig::Setting& config, ftlibrary& ftobj_, register_image_cb register_image_);
     ~info();
 
     void get_session_data();
-    button* parse_key(set_key_image_cb setkey_image, set_key_handle_cb setkey_handle,  unsigned page, unsigned row, unsigned column, const libconfig::Setting& config);
+    button* parse_key(set_key_buffer_cb setkey_buffer, set_key_handle_cb setkey_handle,  unsigned page, unsigned row, unsigned column, const libconfig::Setting& config);
 
     void add_scene(unsigned idx, const char* name);
     unsigned scene_count() const { return scenes.size(); }
     unsigned transition_count() const { return transitions.size(); }
-    scene& get_current_scene();
-    scene& get_current_preview();
+    // Unknown names result in an object with number zero.
+    const scene& get_current_scene() const;
+    const scene& get_current_preview() const;
     int get_current_duration() const { return current_duration_ms; }
-    scene& get_preview(const std::string& s);
-    transition& get_current_transition();
-    std::string& get_scene_name(unsigned nr) { for (auto& p : scenes) if (p.second.nr == nr) return p.second.name; throw std::runtime_error("invalid scene number"); }
-    std::string& get_transition_name(unsigned nr) { for (auto& p : transitions) if (p.second.nr == nr) return p.second.name; throw std::runtime_error("invalid transition number"); }
+    const transition& get_current_transition() const;
+    const std::string& get_scene_name(unsigned nr) const { if (auto s = scenes.find(nr)) return s->name; throw std::runtime_error("invalid scene number"); }
+    const std::string& get_transition_name(unsigned nr) const { if (auto t = transitions.find(nr)) return t->name; throw std::runtime_error("invalid transition number"); }
+    // The scene whose items the source keys show.
+    const std::string& shown_scene() const { return studio_mode ? current_preview : current_scene; }
+    scene_items& shown_items();
+    // The items of the scene if they are known.
+    scene_items* known_items(const std::string& name);
+    scene_items& load_items(scene& s);
 
     void worker_thread();
     void callback(const Json::Value& val);
@@ -227,17 +281,50 @@ namespace obs {
 
     const register_image_cb register_image;
 
+    // All icons which are loaded on demand.  If requested they are loaded in the background
+    // once the keys are shown.
+    std::vector<lazy_icon> icons;
+    lazy_icon make_icon(const std::string& name);
+    bool warm = false;
+    void warm_icons();
+    std::thread warmer;
+
+    label_cache labels;
+    static label_cache::key_type label_key(const std::vector<std::string>& vs, const std::string& font, const std::string& background_name, const Magick::Color& foreground, double widthfactor, double heightfactor, double posx, double posy);
+    int label_icon(const std::vector<std::string>& vs, ftface& fontobj, const std::string& font, const std::string& background_name, const Magick::Color& foreground, double widthfactor = 0.8, double heightfactor = 0.8, double posx = 0.5, double posy = 0.5);
+
     ftlibrary& ftobj;
+    render_pool renderers;
+
+    // Render all labels which can be shown for the current session in advance.
+    bool prerender = false;
+    void prerender_labels(button_class bc);
 
     bool created_ws = false;
     bool connected = false;
-    std::queue<work_request> worker_queue;
+    // Requests are passed from the obsws thread to the worker thread without taking a
+    // lock.  Other threads only set flags.  The worker thread sleeps on the eventfd.  If
+    // the queue is full the obsws thread does not wait, the event is dropped and the
+    // session state is read again instead.
+    static constexpr size_t worker_queue_size = 1024;
+    spsc_ring<work_request,worker_queue_size> worker_queue;
+    // Key presses which need the session state are passed from the main thread the same
+    // way.  Presses which do not fit are ignored.
+    static constexpr size_t key_queue_size = 64;
+    spsc_ring<work_request,key_queue_size> key_queue;
+    int worker_efd = -1;
+    std::atomic<bool> resync = false;
+    std::atomic<bool> ftb_frame_due = false;
+    // Set by the main thread, the worker redraws the buttons.  Only the worker renders,
+    // the fonts of the buttons are not shared between threads.
+    std::atomic<bool> buttons_due = false;
+    void enqueue(work_request&& req);
+    void wake_worker();
+    size_t reported_high_water = 0;
+    // Requests taken from the queue by the worker thread and not yet handled.
+    std::deque<work_request> worker_pending;
     work_request get_request();
-    using timeout_clock = std::chrono::system_clock;
-    std::optional<work_request> get_request(const std::chrono::time_point<timeout_clock>& to);
 
-    std::condition_variable worker_cv;
-    std::mutex worker_m;
     std::atomic<bool> terminate = false;
     std::thread worker;
 
@@ -250,20 +337,13 @@ namespace obs {
 
     bool ignore_next_transition_change = false;
 
-    struct name_enabled_type {
-      std::string uuid { };
-      std::string name { };
-      unsigned id = 0;
-      bool enabled = false;
-    };
-
-    std::unordered_map<std::string,obs::scene> scenes;
+    ordered_registry<obs::scene> scenes;
     std::string current_scene;
     std::string saved_scene;
-    std::vector<name_enabled_type> current_sources;
+    scene_items no_items;
     std::string current_preview;
     std::string saved_preview;
-    std::unordered_map<std::string,obs::transition> transitions;
+    ordered_registry<obs::transition> transitions;
     std::string current_transition;
     unsigned current_duration_ms;
     std::atomic_flag handle_next_transition_change = true;
@@ -282,14 +362,14 @@ namespace obs {
     const Magick::Color im_white;
     const Magick::Color im_darkgray;
 
-    const int obsicon;
-    const int live_unused_icon;
-    const int preview_unused_icon;
-    const int source_unused_icon;
-    const int transition_unused_icon;
+    const lazy_icon obsicon;
+    const lazy_icon live_unused_icon;
+    const lazy_icon preview_unused_icon;
+    const lazy_icon source_unused_icon;
+    const lazy_icon transition_unused_icon;
 
     struct ftb_handler {
-      std::vector<int> icons;
+      std::vector<lazy_icon> icons;
       std::atomic<int> cycle = -1;
 
       bool active() const { return cycle >= 0; }
@@ -299,9 +379,17 @@ namespace obs {
       void start() { cycle = 0; }
       void stop() { cycle = -1; }
 
-      int get() const { return icons[size_t(cycle) >= icons.size() ? int(2 * icons.size() - 1 - cycle) : int(cycle)]; }
+      const lazy_icon& get() const { return icons[size_t(cycle) >= icons.size() ? int(2 * icons.size() - 1 - cycle) : int(cycle)]; }
     } ftb;
 
+    // The frames of the FTB animation are requested by a timer and drawn by the worker
+    // thread like every other update.  START_FTB and STOP_FTB can be called from any thread.
+    static constexpr auto ftb_frame_time = std::chrono::milliseconds(75);
+    timer_service timers;
+    std::atomic<timer_service::id_type> ftb_timer = 0;
+    void start_ftb();
+    void stop_ftb();
+
     const std::string obsfont;
   };
 
@@ -0,0 +1,72 @@
+#ifndef _REGISTRY_HH
+#define _REGISTRY_HH 1
+
+#include <cassert>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+
+// Objects with unique names, numbered from one in the order OBS lists them.  T needs the
+// members nr and name and a constructor taking both.  Objects are found by number and by
+// name in constant time and do not move in memory.  Inserting or removing an object only
+// renumbers the objects after it.  The names must not be changed, the index refers to them.
+template<typename T>
+struct ordered_registry {
+  size_t size() const { return by_nr.size(); }
+  bool empty() const { return by_nr.empty(); }
+
+  // Number zero and numbers past the end are not found.
+  T* find(unsigned nr) { return nr - 1 < by_nr.size() ? by_nr[nr - 1].get() : nullptr; }
+  const T* find(unsigned nr) const { return nr - 1 < by_nr.size() ? by_nr[nr - 1].get() : nullptr; }
+  T* find(std::string_view name) { auto it = by_name.find(name); return it != by_name.end() ? it->second : nullptr; }
+  const T* find(std::string_view name) const { auto it = by_name.find(name); return it != by_name.end() ? it->second : nullptr; }
+  bool contains(std::string_view name) const { return by_name.contains(name); }
+
+  // Insert a new object as number NR.  Nothing happens if the name is already used.
+  T* insert(unsigned nr, const std::string& name)
+  {
+    assert(nr >= 1 && nr <= by_nr.size() + 1);
+    if (by_name.contains(name))
+      return nullptr;
+    auto& p = *by_nr.emplace(by_nr.begin() + (nr - 1), std::make_unique<T>(nr, name));
+    by_name.emplace(p->name, p.get());
+    renumber(nr + 1);
+    return p.get();
+  }
+  T* append(const std::string& name) { return insert(by_nr.size() + 1, name); }
+
+  // The number the object had or zero if there is none with the name.
+  unsigned erase(std::string_view name)
+  {
+    auto it = by_name.find(name);
+    if (it == by_name.end())
+      return 0;
+    auto nr = it->second->nr;
+    by_name.erase(it);
+    by_nr.erase(by_nr.begin() + (nr - 1));
+    renumber(nr);
+    return nr;
+  }
+
+  void clear()
+  {
+    by_name.clear();
+    by_nr.clear();
+  }
+
+private:
+  void renumber(unsigned from)
+  {
+    for (auto i = from; i <= by_nr.size(); ++i)
+      by_nr[i - 1]->nr = i;
+  }
+
+  std::vector<std::unique_ptr<T>> by_nr;
+  // The keys point to the names in the objects.
+  std::unordered_map<std::string_view,T*> by_name;
+};
+
+#endif // registry.hh
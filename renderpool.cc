@@ -0,0 +1,84 @@
+#include "renderpool.hh"
+
+
+ftface& render_pool::context::face(const std::string& font)
+{
+  auto it = faces.find(font);
+  if (it == faces.end())
+    it = faces.emplace(std::piecewise_construct, std::forward_as_tuple(font), std::forward_as_tuple(ftobj, font)).first;
+  return it->second;
+}
+
+
+render_pool::render_pool(ftlibrary& ftobj_, unsigned nthreads)
+: ftobj(ftobj_), local(ftobj_)
+{
+  // With a single thread there is nothing to gain, the caller runs the jobs.
+  if (nthreads > 1)
+    for (unsigned i = 0; i < nthreads; ++i)
+      threads.emplace_back([this]{ thread_main(); });
+}
+
+
+render_pool::~render_pool()
+{
+  {
+    std::lock_guard<std::mutex> guard(m);
+    terminate = true;
+  }
+  work_cv.notify_all();
+  for (auto& t : threads)
+    t.join();
+}
+
+
+void render_pool::run(std::vector<job_type>&& newjobs)
+{
+  if (threads.empty()) {
+    for (auto& j : newjobs)
+      j(local);
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(m);
+  jobs = std::move(newjobs);
+  next = 0;
+  unfinished = jobs.size();
+  error = nullptr;
+  work_cv.notify_all();
+
+  done_cv.wait(lock, [this]{ return unfinished == 0; });
+  jobs.clear();
+
+  if (error)
+    std::rethrow_exception(std::exchange(error, nullptr));
+}
+
+
+void render_pool::thread_main()
+{
+  context ctx(ftobj);
+
+  std::unique_lock<std::mutex> lock(m);
+  while (true) {
+    work_cv.wait(lock, [this]{ return terminate || next < jobs.size(); });
+    if (terminate)
+      break;
+
+    auto& job = jobs[next++];
+    lock.unlock();
+    std::exception_ptr e;
+    try {
+      job(ctx);
+    }
+    catch (...) {
+      e = std::current_exception();
+    }
+    lock.lock();
+
+    if (e && ! error)
+      error = e;
+    if (--unfinished == 0)
+      done_cv.notify_one();
+  }
+}
@@ -0,0 +1,60 @@
+#ifndef _RENDERPOOL_HH
+#define _RENDERPOOL_HH 1
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "ftlibrary.hh"
+
+
+// Threads to render button labels in parallel.  A FreeType face must not be used by more
+// than one thread at a time, every thread therefore has its own set of faces which are
+// kept for the lifetime of the pool.
+struct render_pool {
+  render_pool(ftlibrary& ftobj_, unsigned nthreads);
+  ~render_pool();
+
+  struct context {
+    context(ftlibrary& ftobj_) : ftobj(ftobj_) { }
+
+    ftface& face(const std::string& font);
+
+  private:
+    ftlibrary& ftobj;
+    std::map<std::string,ftface> faces;
+  };
+  using job_type = std::function<void(context&)>;
+
+  // Run all jobs and wait until they are finished.  If a job throws an exception the
+  // first one is rethrown after all jobs are done.  Without threads the jobs are run by
+  // the caller.
+  void run(std::vector<job_type>&& jobs);
+
+  unsigned size() const { return threads.size(); }
+
+private:
+  void thread_main();
+
+  ftlibrary& ftobj;
+  context local;
+
+  std::mutex m;
+  std::condition_variable work_cv;
+  std::condition_variable done_cv;
+  std::vector<job_type> jobs;
+  size_t next = 0;
+  size_t unfinished = 0;
+  std::exception_ptr error;
+  bool terminate = false;
+
+  std::vector<std::thread> threads;
+};
+
+#endif // renderpool.hh
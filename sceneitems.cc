@@ -0,0 +1,119 @@
+#include <algorithm>
+
+#include "sceneitems.hh"
+
+
+namespace obs {
+
+  std::optional<size_t> scene_items::find(unsigned id) const
+  {
+    if (auto it = by_id.find(id); it != by_id.end())
+      return it->second;
+    return std::nullopt;
+  }
+
+
+  std::vector<size_t> scene_items::find(const std::string& uuid) const
+  {
+    std::vector<size_t> res;
+    auto r = by_uuid.equal_range(uuid);
+    for (auto it = r.first; it != r.second; ++it)
+      if (auto id = by_id.find(it->second); id != by_id.end() && id->second < items.size())
+        res.emplace_back(id->second);
+    return res;
+  }
+
+
+  void scene_items::assign(const Json::Value& list)
+  {
+    clear();
+    for (const auto& s : list) {
+      auto idx = s["sceneItemIndex"].asUInt();
+      if (items.size() <= idx)
+        items.resize(idx + 1);
+      items[idx].uuid = s["sourceUuid"].asString();
+      items[idx].name = s["sourceName"].asString();
+      items[idx].id = s["sceneItemId"].asUInt();
+      items[idx].enabled = s["sceneItemEnabled"].asBool();
+      by_uuid.emplace(items[idx].uuid, items[idx].id);
+    }
+    reindex(0);
+  }
+
+
+  bool scene_items::insert(size_t idx, item&& it)
+  {
+    // The item is part of the list already if the list was requested after it was created.
+    if (by_id.contains(it.id))
+      return false;
+    // The index can be out of date when events are handled for a list which was fetched later.
+    idx = std::min(idx, items.size());
+    by_uuid.emplace(it.uuid, it.id);
+    items.emplace(items.begin() + idx, std::move(it));
+    reindex(idx);
+    return true;
+  }
+
+
+  bool scene_items::erase(unsigned id)
+  {
+    auto it = by_id.find(id);
+    if (it == by_id.end() || it->second >= items.size())
+      return false;
+    auto idx = it->second;
+    by_id.erase(it);
+    auto r = by_uuid.equal_range(items[idx].uuid);
+    for (auto u = r.first; u != r.second; ++u)
+      if (u->second == id) {
+        by_uuid.erase(u);
+        break;
+      }
+    items.erase(items.begin() + idx);
+    reindex(idx);
+    return true;
+  }
+
+
+  // The order can be out of date as well.  IDs which are not known are ignored, the
+  // items which are not mentioned keep their order behind the others, and the positions
+  // are compacted.
+  void scene_items::reorder(const std::vector<std::pair<unsigned,unsigned>>& order)
+  {
+    std::vector<std::pair<unsigned,size_t>> moves;
+    std::vector<bool> moved(items.size());
+    for (auto [id, idx] : order)
+      if (auto it = by_id.find(id); it != by_id.end() && it->second < items.size() && ! moved[it->second]) {
+        moved[it->second] = true;
+        moves.emplace_back(idx, it->second);
+      }
+    std::stable_sort(moves.begin(), moves.end(), [](const auto& l, const auto& r){ return l.first < r.first; });
+
+    std::vector<item> res;
+    res.reserve(items.size());
+    for (auto [idx, from] : moves)
+      res.emplace_back(std::move(items[from]));
+    for (size_t from = 0; from < items.size(); ++from)
+      if (! moved[from])
+        res.emplace_back(std::move(items[from]));
+    items = std::move(res);
+    by_id.clear();
+    reindex(0);
+  }
+
+
+  void scene_items::clear()
+  {
+    items.clear();
+    by_id.clear();
+    by_uuid.clear();
+  }
+
+
+  // The positions from FROM on have changed.
+  void scene_items::reindex(size_t from)
+  {
+    for (auto idx = from; idx < items.size(); ++idx)
+      by_id[items[idx].id] = idx;
+  }
+
+} // namespace obs
@@ -0,0 +1,55 @@
+#ifndef _SCENEITEMS_HH
+#define _SCENEITEMS_HH 1
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <json/json.h>
+
+
+namespace obs {
+
+  // The items of a scene in the order of their index, with indices by scene item ID and
+  // by source UUID.  A source can be shown by more than one item of a scene.  The events
+  // for a scene can predate the list they are applied to, all changes accept stale data.
+  struct scene_items {
+    struct item {
+      std::string uuid { };
+      std::string name { };
+      unsigned id = 0;
+      bool enabled = false;
+    };
+
+    size_t size() const { return items.size(); }
+    item& operator[](size_t idx) { return items[idx]; }
+    const item& operator[](size_t idx) const { return items[idx]; }
+
+    // Position of the item with scene item ID.
+    std::optional<size_t> find(unsigned id) const;
+    // Positions of the items which show the source with UUID.
+    std::vector<size_t> find(const std::string& uuid) const;
+
+    // Replace the content with the sceneItems array of a GetSceneItemList response.
+    void assign(const Json::Value& list);
+    // Nothing happens if the ID is known already.
+    bool insert(size_t idx, item&& it);
+    bool erase(unsigned id);
+    // New positions for the items as pairs of scene item ID and index.
+    void reorder(const std::vector<std::pair<unsigned,unsigned>>& order);
+    void clear();
+
+  private:
+    void reindex(size_t from);
+
+    std::vector<item> items;
+    std::unordered_map<unsigned,size_t> by_id;
+    std::unordered_multimap<std::string,unsigned> by_uuid;
+  };
+
+} // namespace obs
+
+#endif // sceneitems.hh
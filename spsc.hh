@@ -0,0 +1,57 @@
+#ifndef _SPSC_HH
+#define _SPSC_HH 1
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+
+// Bounded queue for exactly one producer and one consumer thread.  Neither side ever
+// blocks or takes a lock; a full queue makes PUSH fail and the producer has to deal with
+// the lost element.  The highest number of queued elements is recorded.
+template<typename T, size_t N>
+struct spsc_ring {
+  static_assert((N & (N - 1)) == 0, "capacity must be a power of two");
+
+  static constexpr size_t capacity() { return N; }
+
+  bool push(T&& v)
+  {
+    auto h = head.load(std::memory_order_relaxed);
+    auto used = h - tail.load(std::memory_order_acquire);
+    if (used == N)
+      return false;
+    slots[h % N] = std::move(v);
+    head.store(h + 1, std::memory_order_release);
+
+    if (used + 1 > high.load(std::memory_order_relaxed))
+      high.store(used + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+  bool pop(T& v)
+  {
+    auto t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire))
+      return false;
+    v = std::move(slots[t % N]);
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Only updated by the producer, can be read by any thread.
+  size_t high_water() const { return high.load(std::memory_order_relaxed); }
+
+private:
+  static constexpr size_t line_size = 64;
+
+  // The indices only grow.  They are modified by different threads and are kept in
+  // separate cache lines.
+  alignas(line_size) std::atomic<size_t> head = 0;
+  std::atomic<size_t> high = 0;
+  alignas(line_size) std::atomic<size_t> tail = 0;
+  alignas(line_size) std::array<T,N> slots;
+};
+
+#endif // spsc.hh
@@ -0,0 +1,192 @@
+#include "startup.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace startup {
+
+  namespace {
+
+    using clock = std::chrono::steady_clock;
+
+    // All times are in milliseconds since the initialization of the program.
+    const clock::time_point origin = clock::now();
+
+    double now()
+    {
+      return std::chrono::duration<double,std::milli>(clock::now() - origin).count();
+    }
+
+
+    struct record {
+      std::string name;
+      std::thread::id thread;
+      bool nested;
+      double start;
+      double end;
+    };
+
+
+    std::atomic<bool> active = false;
+    bool print_breakdown = false;
+    std::filesystem::path trace_file;
+
+    // Only used by the main thread.
+    double last_lap = 0.0;
+
+    std::mutex m;
+    std::vector<record> records;
+    std::map<std::thread::id,unsigned> thread_numbers;
+    bool finished = false;
+    std::ofstream trace_out;
+    // Number of records reported after FINISH.
+    constexpr unsigned max_late = 256;
+    unsigned nlate = 0;
+
+
+    unsigned thread_number(std::thread::id id)
+    {
+      return thread_numbers.emplace(id, 1 + thread_numbers.size()).first->second;
+    }
+
+
+    void print(const record& r)
+    {
+      std::cout << "startup: " << std::setw(9) << r.start << " ms  +" << std::setw(9) << r.end - r.start << " ms  [" << thread_number(r.thread) << "] "
+                << (r.nested ? "  " : "") << r.name << '\n';
+    }
+
+
+    void write_record(const record& r)
+    {
+      trace_out << "  {\"name\":\"";
+      for (auto c : r.name) {
+        if (c == '"' || c == '\\')
+          trace_out << '\\';
+        trace_out << c;
+      }
+      trace_out << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread_number(r.thread) << ",\"ts\":" << std::llround(r.start * 1000.0)
+                << ",\"dur\":" << std::llround((r.end - r.start) * 1000.0) << '}';
+    }
+
+
+    // The closing bracket of the array is optional in the trace format.  It is left out so
+    // that the records of scopes which end later can be appended.
+    void write_trace()
+    {
+      trace_out.open(trace_file);
+      if (! trace_out) {
+        std::cerr << "cannot write startup trace " << trace_file << '\n';
+        return;
+      }
+
+      trace_out << '[';
+      const char* sep = "\n";
+      for (const auto& r : records) {
+        trace_out << sep;
+        write_record(r);
+        sep = ",\n";
+      }
+      trace_out << std::flush;
+    }
+
+
+    void add(record&& r)
+    {
+      std::lock_guard<std::mutex> guard(m);
+      if (! finished) {
+        records.emplace_back(std::move(r));
+        thread_number(records.back().thread);
+        return;
+      }
+
+      // Later scopes are reported but not kept.  Lazily loaded images would otherwise be
+      // recorded for the lifetime of the program.
+      if (nlate >= max_late)
+        return;
+      ++nlate;
+      if (print_breakdown)
+        print(r);
+      if (trace_out.is_open()) {
+        trace_out << ",\n";
+        write_record(r);
+        trace_out << std::flush;
+      }
+    }
+
+  } // anonymous namespace
+
+
+  void enable(bool print, const std::filesystem::path& trace)
+  {
+    print_breakdown = print;
+    trace_file = trace;
+    active = print || ! trace.empty();
+  }
+
+
+  bool enabled()
+  {
+    return active;
+  }
+
+
+  void lap(const char* name)
+  {
+    if (! active)
+      return;
+
+    auto t = now();
+    add(record{ name, std::this_thread::get_id(), false, last_lap, t });
+    last_lap = t;
+  }
+
+
+  scope::scope(const char* name_, std::string_view detail_)
+  : name(name_), start(active ? now() : 0.0)
+  {
+    if (active)
+      detail = detail_;
+  }
+
+
+  scope::~scope()
+  {
+    if (active)
+      add(record{ detail.empty() ? std::string(name) : std::string(name) + ' ' + detail, std::this_thread::get_id(), true, start, now() });
+  }
+
+
+  void finish()
+  {
+    if (! active)
+      return;
+
+    std::lock_guard<std::mutex> guard(m);
+    if (finished)
+      return;
+    finished = true;
+
+    std::ranges::stable_sort(records, {}, &record::start);
+
+    if (print_breakdown) {
+      std::cout << std::fixed << std::setprecision(2);
+      for (const auto& r : records)
+        print(r);
+      std::cout << "startup: keys painted after " << last_lap << " ms\n";
+    }
+    if (! trace_file.empty())
+      write_trace();
+  }
+
+} // namespace startup
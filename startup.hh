@@ -0,0 +1,48 @@
+#ifndef _STARTUP_HH
+#define _STARTUP_HH 1
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+
+// Timing of the phases of the startup.  Nothing is recorded unless the profile is enabled
+// on the command line.  The main thread goes through a sequence of phases, each ended by
+// a call to LAP.  Work which overlaps with that sequence, possibly on other threads, is
+// timed with SCOPE objects.  FINISH is called once the keys are painted for the first
+// time.  It prints the breakdown and/or writes a trace file in the Chrome trace event
+// format which can be loaded into chrome://tracing or Perfetto.  Scopes which end later,
+// e.g., the OBS handshake, are reported when they end, up to a limit.
+namespace startup {
+
+  void enable(bool print, const std::filesystem::path& trace);
+  bool enabled();
+
+  // End the current phase of the main thread, named NAME, and start the next.
+  void lap(const char* name);
+
+  // The work done in member initializers can be timed by members of this type placed
+  // after the member which has to be timed.
+  struct mark {
+    mark(const char* name) { lap(name); }
+  };
+
+  // Time the lifetime of the object.  DETAIL is appended to the name.
+  struct scope {
+    scope(const char* name_, std::string_view detail_ = { });
+    ~scope();
+
+    scope(const scope&) = delete;
+    scope& operator=(const scope&) = delete;
+
+  private:
+    const char* name;
+    std::string detail;
+    double start;
+  };
+
+  void finish();
+
+} // namespace startup
+
+#endif // startup.hh
@@ -0,0 +1,82 @@
+#include <algorithm>
+
+#include "timer.hh"
+
+
+timer_service::timer_service()
+: thread([this]{ thread_main(); })
+{
+}
+
+
+timer_service::~timer_service()
+{
+  shutdown();
+}
+
+
+void timer_service::shutdown()
+{
+  {
+    std::lock_guard<std::mutex> guard(m);
+    terminate = true;
+  }
+  cv.notify_all();
+  if (thread.joinable())
+    thread.join();
+}
+
+
+timer_service::id_type timer_service::start(clock::duration period, callback_type fn)
+{
+  std::lock_guard<std::mutex> guard(m);
+  auto id = next_id++;
+  if (next_id == 0)
+    next_id = 1;
+  timers.emplace(id, timer{ clock::now() + period, period, std::move(fn) });
+  cv.notify_all();
+  return id;
+}
+
+
+void timer_service::stop(id_type id)
+{
+  std::lock_guard<std::mutex> guard(m);
+  if (timers.erase(id) != 0)
+    // Do not let the thread sleep until the deadline of a timer which is gone.
+    cv.notify_all();
+}
+
+
+void timer_service::thread_main()
+{
+  std::unique_lock<std::mutex> lock(m);
+  while (! terminate) {
+    if (timers.empty()) {
+      cv.wait(lock);
+      continue;
+    }
+
+    // The timer can be removed while the thread waits, do not refer to it.
+    auto deadline = std::min_element(timers.begin(), timers.end(), [](const auto& l, const auto& r){ return l.second.deadline < r.second.deadline; })->second.deadline;
+    if (cv.wait_until(lock, deadline) == std::cv_status::no_timeout)
+      // A timer was added or removed or the service is shutting down.
+      continue;
+
+    auto now = clock::now();
+    auto it = std::min_element(timers.begin(), timers.end(), [](const auto& l, const auto& r){ return l.second.deadline < r.second.deadline; });
+    if (it == timers.end() || it->second.deadline > now)
+      continue;
+
+    // Keep the phase unless a frame was missed completely.
+    auto& t = it->second;
+    t.deadline += t.period;
+    if (t.deadline <= now)
+      t.deadline = now + t.period;
+
+    auto fn = t.fn;
+    lock.unlock();
+    fn();
+    lock.lock();
+  }
+}
@@ -0,0 +1,52 @@
+#ifndef _TIMER_HH
+#define _TIMER_HH 1
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+
+
+// Periodic timers driven by the monotonic clock.  All timers share one thread which
+// sleeps until the earliest deadline.  The callbacks are run by that thread without any
+// lock held and must be short; usually they only post a request to another thread.  If
+// the deadlines cannot be kept, e.g., after a suspend, frames are dropped instead of
+// being delivered in a burst.
+struct timer_service {
+  using clock = std::chrono::steady_clock;
+  using id_type = unsigned;
+  using callback_type = std::function<void()>;
+
+  timer_service();
+  ~timer_service();
+
+  // Call FN every PERIOD, the first time one period from now.  The returned identifier is
+  // never zero.
+  id_type start(clock::duration period, callback_type fn);
+  // Remove the timer.  A callback which is running at the time still completes.
+  void stop(id_type id);
+  // Stop the thread.  When this returns no callback is running or will be run.  Timers
+  // started afterwards never fire.
+  void shutdown();
+
+private:
+  void thread_main();
+
+  struct timer {
+    clock::time_point deadline;
+    clock::duration period;
+    callback_type fn;
+  };
+
+  std::mutex m;
+  std::condition_variable cv;
+  std::map<id_type,timer> timers;
+  id_type next_id = 1;
+  bool terminate = false;
+
+  std::thread thread;
+};
+
+#endif // timer.hh